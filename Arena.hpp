@@ -0,0 +1,116 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+#include <stdint.h>
+#include <string.h>
+
+// variable length payloads, e.g. SysEx, for events whose data does not
+// fit their three bytes; the event keeps the payload's offset instead.
+// Allocating bumps a mark and clear() frees everything at once. A
+// payload can also be given back on its own, e.g. once its event has
+// played: its room is reused once every payload allocated before it is
+// given back too, allocating starting over at the front when the end is
+// reached
+template<uint32_t SIZE>
+class Arena
+{
+private:
+  // flagged in a payload's length once it is given back
+  static const uint8_t RELEASED = 0x80;
+
+  uint8_t data[SIZE];
+  uint32_t used;  // end of the newest payload
+  uint32_t first; // start of the oldest payload not given back
+  uint32_t wrap;  // end of the payloads from first on, once allocating
+                  // started over at the front; 0 until then
+
+public:
+  // what allocate() returns when there is no room
+  static const uint32_t UNDEFINED = 0xFFFFFF;
+
+  Arena() : used{0}, first{0}, wrap{0}
+  {
+  }
+
+  void clear()
+  {
+    used = 0;
+    first = 0;
+    wrap = 0;
+  }
+
+  // room for length bytes, at most 32767, stored behind their length
+  uint32_t allocate(const uint16_t length)
+  {
+    const uint32_t size {2 + static_cast<uint32_t>(length)};
+    if ( length >= RELEASED << 8 || used >= UNDEFINED )
+      return UNDEFINED;
+    if ( wrap ? first - used < size : SIZE - used < size )
+    {
+      // start over in front of the oldest payload still held
+      if ( wrap || first < size )
+        return UNDEFINED;
+      wrap = used;
+      used = 0;
+    }
+    const uint32_t offset {used};
+    data[offset] = length >> 8;
+    data[offset + 1] = length & 0xFF;
+    used += size;
+    return offset;
+  }
+
+  // gives back the payload at offset, which is not read again
+  void release(const uint32_t offset)
+  {
+    data[offset] |= RELEASED;
+    while ( (wrap || first < used) && (data[first] & RELEASED) )
+    {
+      first += 2 + getLength(first);
+      if ( wrap && first == wrap )
+      {
+        first = 0;
+        wrap = 0;
+      }
+    }
+    if ( !wrap && first == used )
+      first = used = 0;
+  }
+
+  uint8_t *getPayload(const uint32_t offset)
+  {
+    return data + offset + 2;
+  }
+
+  const uint8_t *getPayload(const uint32_t offset) const
+  {
+    return data + offset + 2;
+  }
+
+  uint16_t getLength(const uint32_t offset) const
+  {
+    return (data[offset] & ~RELEASED) << 8 | data[offset + 1];
+  }
+
+  // bytes from the front up to the end of the last payload
+  uint32_t getUsed() const
+  {
+    return wrap ? wrap : used;
+  }
+
+  // the whole arena as bytes, for saving it as it is
+  const uint8_t *getData() const
+  {
+    return data;
+  }
+
+  // takes back length bytes saved from getData(), 0 when they do not fit
+  uint8_t *restore(const uint32_t length)
+  {
+    if ( length > SIZE )
+      return 0;
+    clear();
+    used = length;
+    return data;
+  }
+};
+#endif
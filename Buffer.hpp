@@ -10,12 +10,14 @@ using namespace std;
 
 static const int16_t UNDEFINED {-1};
 
-template<class T>
+// INDEX is the signed type links are stored in; it bounds the capacity
+// and sets the size of every node
+template<class T, class INDEX = int16_t>
 class Node
 {
 public:
-  int16_t next;
-  int16_t prev;
+  INDEX next;
+  INDEX prev;
   T data;
 
   Node() : next{UNDEFINED}, prev{UNDEFINED}
@@ -37,26 +39,328 @@ struct InsertResult {
   }
 };
 
+// sparse checkpoints into each track's list. Each gap keeps a count of
+// its nodes, never less than the real one, and a gap that grows past
+// twice the stride it was laid out with is split in two, or the track
+// re-indexed once the slots run out, so a seek walks at most that far
+template<class T, uint8_t TRACKS, uint8_t SLOTS, class INDEX = int16_t>
+class SkipIndex
+{
+private:
+  INDEX slot[TRACKS][SLOTS];
+  // nodes from each slot up to the next one
+  INDEX gap[TRACKS][SLOTS];
+  // and before the first
+  INDEX lead[TRACKS];
+  INDEX limit[TRACKS];
+  uint8_t used[TRACKS];
+  INDEX length[TRACKS];
+  INDEX built[TRACKS];
+  bool stale[TRACKS];
+
+  // first slot whose data is greater than data
+  uint8_t upperSlot(const uint8_t track, const T &data, const Node<T, INDEX> *nodes) const
+  {
+    uint8_t lo {0};
+    uint8_t hi {used[track]};
+    while ( lo < hi )
+    {
+      const uint8_t mid = (lo + hi) / 2;
+      if ( nodes[slot[track][mid]].data > data )
+        hi = mid;
+      else
+        lo = mid + 1;
+    }
+    return lo;
+  }
+
+  // counts gap g exactly and, past the limit, puts a slot in its middle
+  void split(const uint8_t track, const uint8_t g, const Node<T, INDEX> *nodes)
+  {
+    const INDEX end = g + 1 < used[track] ? slot[track][g + 1] : UNDEFINED;
+    INDEX n {0};
+    for ( INDEX index {slot[track][g]}; index != end; index = nodes[index].next )
+      ++ n;
+    if ( n <= limit[track] )
+    {
+      gap[track][g] = n;
+      return;
+    }
+    if ( used[track] == SLOTS )
+    {
+      stale[track] = true;
+      return;
+    }
+    INDEX middle {slot[track][g]};
+    for ( INDEX i {0}; i < n / 2; ++i )
+      middle = nodes[middle].next;
+    for ( uint8_t i {used[track]}; i > g + 1; --i )
+    {
+      slot[track][i] = slot[track][i - 1];
+      gap[track][i] = gap[track][i - 1];
+    }
+    ++ used[track];
+    slot[track][g + 1] = middle;
+    gap[track][g] = n / 2;
+    gap[track][g + 1] = n - n / 2;
+  }
+
+  // first slot whose data is not less than data
+  uint8_t lowerSlot(const uint8_t track, const T &data, const Node<T, INDEX> *nodes) const
+  {
+    uint8_t lo {0};
+    uint8_t hi {used[track]};
+    while ( lo < hi )
+    {
+      const uint8_t mid = (lo + hi) / 2;
+      if ( data > nodes[slot[track][mid]].data )
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
+
+  void rebuild(const uint8_t track, const Node<T, INDEX> *nodes, const INDEX head)
+  {
+    const INDEX stride = length[track] / SLOTS + 1;
+    INDEX i {0};
+    used[track] = 0;
+    for ( INDEX index {head}; index != UNDEFINED; index = nodes[index].next )
+    {
+      if ( i++ % stride == 0 )
+      {
+        slot[track][used[track]] = index;
+        gap[track][used[track]++] = 0;
+      }
+      ++ gap[track][used[track] - 1];
+    }
+    lead[track] = 0;
+    limit[track] = 2 * stride;
+    built[track] = length[track];
+    stale[track] = false;
+  }
+
+public:
+  void clear()
+  {
+    for ( uint8_t i{0}; i < TRACKS; ++i )
+    {
+      used[i] = 0;
+      length[i] = 0;
+      built[i] = 0;
+      stale[i] = true;
+    }
+  }
+
+  // nodes moved; every track is laid out again on its next seek
+  void invalidate()
+  {
+    for ( uint8_t i{0}; i < TRACKS; ++i )
+      stale[i] = true;
+  }
+
+  // must be called once the node is linked in. Among equal data the
+  // node may have gone into any gap the run spans; each counts it
+  void inserted(const uint8_t track, const INDEX node, const Node<T, INDEX> *nodes)
+  {
+    if ( ++length[track] > 2 * built[track] )
+      stale[track] = true;
+    if ( stale[track] )
+      return;
+    const T &data {nodes[node].data};
+    const uint8_t first {lowerSlot(track, data, nodes)};
+    const uint8_t last {upperSlot(track, data, nodes)};
+    if ( first == 0 && ++lead[track] > limit[track] )
+    {
+      stale[track] = true;
+      return;
+    }
+    for ( uint8_t g = first > 0 ? first - 1 : 0; g < last && !stale[track]; ++g )
+      if ( ++gap[track][g] > limit[track] )
+        split(track, g, nodes);
+  }
+
+  // a run of nodes went onto the end; the track is laid out again on its
+  // next seek
+  void appended(const uint8_t track, const INDEX n)
+  {
+    length[track] += n;
+    stale[track] = true;
+  }
 
-template<class T, uint16_t SIZE, uint8_t TRACKS>
+  // a range of nodes went; the track is laid out again on its next seek
+  void erased(const uint8_t track, const INDEX n)
+  {
+    length[track] -= n;
+    stale[track] = true;
+  }
+
+  // must be called while the node is still linked
+  void removed(const uint8_t track, const INDEX node, const Node<T, INDEX> *nodes)
+  {
+    -- length[track];
+    if ( stale[track] )
+      return;
+    for ( uint8_t i {lowerSlot(track, nodes[node].data, nodes)};
+          i < used[track] && nodes[slot[track][i]].data <= nodes[node].data; ++i )
+    {
+      if ( slot[track][i] != node )
+        continue;
+      if ( nodes[node].next != UNDEFINED )
+        slot[track][i] = nodes[node].next;
+      else if ( nodes[node].prev != UNDEFINED )
+        slot[track][i] = nodes[node].prev;
+      else
+        stale[track] = true;
+      // earlier removals can leave neighbouring slots on the same node
+    }
+  }
+
+  #ifdef CATCH_CONFIG_MAIN
+  bool isStale(const uint8_t track) const
+  {
+    return stale[track];
+  }
+
+  // the most nodes a seek walks from a slot, or from the head
+  INDEX getLongestGap(const uint8_t track, const Node<T, INDEX> *nodes, const INDEX head) const
+  {
+    INDEX longest {0};
+    INDEX n {0};
+    uint8_t next {0};
+    for ( INDEX index {head}; index != UNDEFINED; index = nodes[index].next )
+    {
+      for ( ; next < used[track] && index == slot[track][next]; ++next )
+      {
+        longest = max(longest, n);
+        n = 0;
+      }
+      ++ n;
+    }
+    return max(longest, n);
+  }
+  #endif
+
+  // first node not less than data, or UNDEFINED if there is none
+  INDEX lowerBound(const uint8_t track, const T &data, const Node<T, INDEX> *nodes,
+                     const INDEX head)
+  {
+    if ( stale[track] )
+      rebuild(track, nodes, head);
+    const uint8_t i {lowerSlot(track, data, nodes)};
+    INDEX index {i > 0 ? slot[track][i - 1] : head};
+    while ( index != UNDEFINED && data > nodes[index].data )
+      index = nodes[index].next;
+    return index;
+  }
+};
+
+template<class T, uint8_t TRACKS, class INDEX>
+class SkipIndex<T, TRACKS, 0, INDEX>
+{
+public:
+  void clear()
+  {
+  }
+
+  void invalidate()
+  {
+  }
+
+  void inserted(const uint8_t track, const INDEX node, const Node<T, INDEX> *nodes)
+  {
+  }
+
+  void appended(const uint8_t track, const INDEX n)
+  {
+  }
+
+  void erased(const uint8_t track, const INDEX n)
+  {
+  }
+
+  void removed(const uint8_t track, const INDEX node, const Node<T, INDEX> *nodes)
+  {
+  }
+
+  INDEX lowerBound(const uint8_t track, const T &data, const Node<T, INDEX> *nodes,
+                     const INDEX head)
+  {
+    return UNDEFINED;
+  }
+};
+
+
+template<class T, uint32_t SIZE, uint8_t TRACKS, uint8_t CHECKPOINTS = 0, class INDEX = int16_t>
 class Buffer
 {
 private:
-  int16_t available;
-  int16_t pointer[TRACKS];
-  int16_t head[TRACKS];
-  int16_t tail[TRACKS];
-  Node<T> buffer[SIZE];
-  int16_t count;
+  static_assert(static_cast<INDEX>(-1) < 0, "UNDEFINED needs a signed index");
+  static_assert(static_cast<uint32_t>(static_cast<INDEX>(SIZE - 1)) == SIZE - 1,
+                "SIZE does not fit the index type");
+
+  INDEX available; // nodes given back, linked both ways
+  uint32_t fresh;  // nodes from here on were never handed out
+  INDEX pointer[TRACKS];
+  INDEX head[TRACKS];
+  INDEX tail[TRACKS];
+  Node<T, INDEX> buffer[SIZE];
+  INDEX count;
+  SkipIndex<T, TRACKS, CHECKPOINTS, INDEX> index;
+  // compaction pass: the track being laid out, its next node and the
+  // slot that node goes to; TRACKS when no pass is running
+  uint8_t compact_track;
+  INDEX compact_node;
+  INDEX compact_slot;
+  bool compact_edited;
 
   struct SearchResult
   {
-    int16_t last;
-    int16_t curr;
-    //int16_t offset;
+    INDEX last;
+    INDEX curr;
+    //INDEX offset;
     bool go_right;
   };
 
+  // links data in from the tail; after puts it behind a run of equal
+  // data instead of in front
+  const InsertResult<T> appendFromTail(const uint8_t track, const T &data, const bool after)
+  {
+    assert(track < TRACKS);
+    const INDEX new_node {allocate()};
+    buffer[new_node].data = data;
+    InsertResult<T> insert_result{buffer[new_node].data};
+    if ( head[track] == UNDEFINED )
+    {
+      pointer[track] = new_node;
+      insert_result.forward = true;
+    }
+
+    INDEX curr {UNDEFINED};
+    INDEX prev {tail[track]};
+    while ( prev != UNDEFINED &&
+            (after ? buffer[prev].data > data : data <= buffer[prev].data) )
+    {
+      curr = prev;
+      prev = buffer[prev].prev;
+    }
+
+    buffer[new_node].prev = prev;
+    buffer[new_node].next = curr;
+    if ( prev == UNDEFINED )
+      head[track] = new_node;
+    else
+      buffer[prev].next = new_node;
+    if ( curr == UNDEFINED )
+      tail[track] = new_node;
+    else
+      buffer[curr].prev = new_node;
+    ++ count;
+    index.inserted(track, new_node, buffer);
+    return insert_result;
+  }
+
   const SearchResult search(const uint8_t track, const T &data)
   {
     SearchResult result;
@@ -96,31 +400,142 @@ private:
     return result;
  }
 
-public:
-  Buffer()
+  // free nodes are linked both ways so compaction can take any of them;
+  // untouched ones come from the high-water mark so clear() stays cheap
+  INDEX allocate()
   {
-    clear();
+    compact_edited = true;
+    if ( available == UNDEFINED )
+    {
+      assert(fresh < SIZE);
+      return fresh++;
+    }
+    const INDEX node {available};
+    available = buffer[node].next;
+    if ( available != UNDEFINED )
+      buffer[available].prev = UNDEFINED;
+    return node;
   }
 
-  void clear()
+  void release(const INDEX node)
+  {
+    compact_edited = true;
+    buffer[node] = Node<T, INDEX>{};
+    buffer[node].next = available;
+    if ( available != UNDEFINED )
+      buffer[available].prev = node;
+    available = node;
+  }
+
+  static INDEX swapped(const INDEX index, const INDEX a, const INDEX b)
+  {
+    return index == a ? b : index == b ? a : index;
+  }
+
+  // exchanges the places of two nodes, live or free
+  void swap(const INDEX a, const INDEX b)
   {
-    for ( uint32_t i{0}; i < SIZE; ++i )
+    const Node<T, INDEX> node_a {buffer[a]};
+    const Node<T, INDEX> node_b {buffer[b]};
+    if ( node_a.prev != UNDEFINED && node_a.prev != b )
+      buffer[node_a.prev].next = b;
+    if ( node_a.next != UNDEFINED && node_a.next != b )
+      buffer[node_a.next].prev = b;
+    if ( node_b.prev != UNDEFINED && node_b.prev != a )
+      buffer[node_b.prev].next = a;
+    if ( node_b.next != UNDEFINED && node_b.next != a )
+      buffer[node_b.next].prev = a;
+    buffer[b] = node_a;
+    buffer[b].prev = swapped(node_a.prev, a, b);
+    buffer[b].next = swapped(node_a.next, a, b);
+    buffer[a] = node_b;
+    buffer[a].prev = swapped(node_b.prev, a, b);
+    buffer[a].next = swapped(node_b.next, a, b);
+    for ( uint8_t i{0}; i < TRACKS; ++i )
     {
-      buffer[i] = Node<T>{};
-      if ( i == SIZE - 1 )
-	buffer[i].next = UNDEFINED;
+      head[i] = swapped(head[i], a, b);
+      tail[i] = swapped(tail[i], a, b);
+      pointer[i] = swapped(pointer[i], a, b);
+    }
+    available = swapped(available, a, b);
+  }
+
+  // first node of the track not less than data, or UNDEFINED
+  INDEX lowerBound(const uint8_t track, const T &data)
+  {
+    if ( CHECKPOINTS > 0 )
+      return index.lowerBound(track, data, buffer, head[track]);
+    INDEX node {head[track]};
+    while ( node != UNDEFINED && data > buffer[node].data )
+      node = buffer[node].next;
+    return node;
+  }
+
+  template<class F>
+  INDEX erase(const uint8_t track, INDEX node, const T &to, F keep)
+  {
+    INDEX erased {0};
+    while ( node != UNDEFINED && to > buffer[node].data )
+    {
+      if ( keep(buffer[node].data) )
+      {
+        node = buffer[node].next;
+        continue;
+      }
+      const INDEX before {buffer[node].prev};
+      bool pointer_erased {false};
+      bool compact_erased {false};
+      while ( node != UNDEFINED && to > buffer[node].data && !keep(buffer[node].data) )
+      {
+        const INDEX next {buffer[node].next};
+        pointer_erased |= node == pointer[track];
+        compact_erased |= node == compact_node;
+        release(node);
+        ++ erased;
+        node = next;
+      }
+      if ( before == UNDEFINED )
+        head[track] = node;
+      else
+        buffer[before].next = node;
+      if ( node == UNDEFINED )
+        tail[track] = before;
       else
-        buffer[i].next = i + 1;
+        buffer[node].prev = before;
+      if ( pointer_erased )
+        pointer[track] = node;
+      if ( compact_erased )
+        compact_node = node;
     }
+    if ( erased > 0 )
+    {
+      count -= erased;
+      index.erased(track, erased);
+    }
+    return erased;
+  }
 
+public:
+  Buffer()
+  {
+    clear();
+  }
+
+  // O(TRACKS): nodes are only written again when handed out
+  void clear()
+  {
     for ( uint8_t i{0}; i < TRACKS; ++i )
     {
       pointer[i] = UNDEFINED;
       head[i] = UNDEFINED;
       tail[i] = UNDEFINED;
     }
-    available = 0;
+    available = UNDEFINED;
+    fresh = 0;
     count = 0;
+    index.clear();
+    compact_track = TRACKS;
+    compact_node = UNDEFINED;
   }
 
   void returnToZero(const uint8_t track)
@@ -140,7 +555,7 @@ public:
 
   void next(const uint8_t track)
   {
-    Node<T> &current {buffer[pointer[track]]};
+    Node<T, INDEX> &current {buffer[pointer[track]]};
     pointer[track] = current.next;
   }
 
@@ -152,6 +567,12 @@ public:
 
   void seek(const uint8_t track, const T &data)
   {
+    if ( CHECKPOINTS > 0 )
+    {
+      const INDEX found {index.lowerBound(track, data, buffer, head[track])};
+      pointer[track] = found == UNDEFINED ? tail[track] : found;
+      return;
+    }
     SearchResult result {search(track, data)};
     if ( result.curr == UNDEFINED )
       pointer[track] = result.last;
@@ -162,11 +583,9 @@ public:
   const InsertResult<T> insert(const uint8_t track, const T &data)
   {
     assert(track < TRACKS);
-    assert(available != UNDEFINED);
-    buffer[available].data = data;
-    InsertResult<T> insert_result{buffer[available].data};
-    const int16_t new_node {available};
-    available = buffer[available].next;
+    const INDEX new_node {allocate()};
+    buffer[new_node].data = data;
+    InsertResult<T> insert_result{buffer[new_node].data};
     if ( head[track] == UNDEFINED )
     {
       head[track] = new_node;
@@ -178,8 +597,8 @@ public:
     else
     {
       const SearchResult result {search(track, data)};
-      int16_t curr = result.curr;
-      int16_t last = result.last;
+      INDEX curr = result.curr;
+      INDEX last = result.last;
       bool go_right = result.go_right;
       //insert_result.forward |= result.offset > 0;
 
@@ -222,15 +641,34 @@ public:
     }
     insert_result.forward |= pointer[track] == new_node;
     ++ count;
+    index.inserted(track, new_node, buffer);
     return insert_result;
   }
-  
+
+  // bulk-load path: walks left from the tail instead of from the playback
+  // pointer, so data arriving in ascending order is linked in O(1)
+  const InsertResult<T> append(const uint8_t track, const T &data)
+  {
+    // equal data goes in front of the trailing run, same as insert()
+    return appendFromTail(track, data, false);
+  }
+
+  // like append(), but equal data goes behind the trailing run, so
+  // entries that must keep the order they came in, e.g. SysEx, do
+  const InsertResult<T> appendAfter(const uint8_t track, const T &data)
+  {
+    return appendFromTail(track, data, true);
+  }
+
   void remove(const uint8_t track)
   {
     assert(track < TRACKS);
     if ( head[track] == UNDEFINED )
       return;
-    const int16_t curr {pointer[track]};
+    const INDEX curr {pointer[track]};
+    index.removed(track, curr, buffer);
+    if ( curr == compact_node )
+      compact_node = buffer[curr].next;
     if ( curr == tail[track] )
       tail[track] = buffer[curr].prev;
     if ( pointer[track] == head[track] )
@@ -253,47 +691,192 @@ public:
 	pointer[track] = UNDEFINED;
     }
 
-    buffer[curr] = Node<T>{};
-    buffer[curr].next = available;
-    available = curr;
+    release(curr);
     -- count;
   }
 
-  uint16_t getCount() const
+  // links n nodes from the high-water mark onto the end of the track in
+  // one pass, read(T &) filling in each, for loading data already in
+  // order; false, and nothing taken, when they do not fit
+  template<class F>
+  bool fill(const uint8_t track, const INDEX n, F read)
+  {
+    assert(track < TRACKS);
+    if ( n <= 0 )
+      return true;
+    if ( fresh + n > SIZE )
+      return false;
+    const INDEX first = fresh;
+    const INDEX last = fresh + n - 1;
+    for ( INDEX node {first}; node <= last; ++node )
+    {
+      read(buffer[node].data);
+      buffer[node].prev = node == first ? tail[track] : node - 1;
+      buffer[node].next = node == last ? UNDEFINED : node + 1;
+    }
+    index.appended(track, n);
+    if ( tail[track] == UNDEFINED )
+    {
+      head[track] = first;
+      pointer[track] = first;
+    }
+    else
+      buffer[tail[track]].next = first;
+    tail[track] = last;
+    fresh += n;
+    count += n;
+    compact_edited = true;
+    return true;
+  }
+
+  // removes the track's data from from up to before to, except what
+  // keep accepts; each run of removed nodes is spliced out with one
+  // relink. A pointer on a removed node moves on to the next one left
+  template<class F>
+  INDEX eraseRange(const uint8_t track, const T &from, const T &to, F keep)
+  {
+    assert(track < TRACKS);
+    return erase(track, lowerBound(track, from), to, keep);
+  }
+
+  // the same from the playback pointer on, leaving what it passed
+  template<class F>
+  INDEX eraseAhead(const uint8_t track, const T &to, F keep)
+  {
+    assert(track < TRACKS);
+    return erase(track, pointer[track], to, keep);
+  }
+
+  INDEX eraseRange(const uint8_t track, const T &from, const T &to)
+  {
+    return eraseRange(track, from, to, [](const T &) { return false; });
+  }
+
+  // visits the track's data from from up to before to
+  template<class F>
+  void forEachInRange(const uint8_t track, const T &from, const T &to, F f)
+  {
+    for ( INDEX node {lowerBound(track, from)};
+          node != UNDEFINED && to > buffer[node].data; node = buffer[node].next )
+      f(buffer[node].data);
+  }
+
+  // lays nodes out in list order, one track after another, moving at
+  // most budget of them a call so it can run in slices between ticks.
+  // True once a pass has finished; the next call starts another
+  bool compact(uint16_t budget)
+  {
+    bool moved {false};
+    bool finished {false};
+    if ( compact_track == TRACKS )
+    {
+      compact_track = 0;
+      compact_node = head[0];
+      compact_slot = 0;
+      compact_edited = false;
+    }
+    while ( true )
+    {
+      while ( compact_node == UNDEFINED && compact_track < TRACKS )
+        if ( ++compact_track < TRACKS )
+          compact_node = head[compact_track];
+      // edits during a pass can use up the slots early; the ones from
+      // the high-water mark on were never handed out, so moving a node
+      // there would leave its old slot on no list
+      if ( compact_track == TRACKS || static_cast<uint32_t>(compact_slot) >= fresh )
+      {
+        compact_track = TRACKS;
+        finished = true;
+        // with no edits since the pass began every free node is above
+        // the live ones, so the free list folds into the high-water mark
+        if ( !compact_edited )
+        {
+          available = UNDEFINED;
+          fresh = compact_slot;
+        }
+        break;
+      }
+      if ( budget == 0 )
+        break;
+      -- budget;
+      if ( compact_node != compact_slot )
+      {
+        swap(compact_node, compact_slot);
+        moved = true;
+      }
+      compact_node = buffer[compact_slot].next;
+      ++ compact_slot;
+    }
+    if ( moved )
+      index.invalidate();
+    return finished;
+  }
+
+  INDEX getCount() const
   {
     return count;
   }
 
+  // nodes in use, in percent; under 100 the next insert finds one
+  uint8_t getUsage() const
+  {
+    return static_cast<uint64_t>(count) * 100 / SIZE;
+  }
+
+  // visits a track in order without touching its playback pointer
+  template<class F>
+  void forEach(const uint8_t track, F f) const
+  {
+    for ( INDEX index {head[track]};
+	  index != UNDEFINED;
+	  index = buffer[index].next )
+      f(buffer[index].data);
+  }
+
   #ifdef CATCH_CONFIG_MAIN
-  int16_t getHead(uint8_t track) const
+  INDEX getHead(uint8_t track) const
   {
     return head[track];
   }
 
-  int16_t getTail(uint8_t track) const
+  INDEX getTail(uint8_t track) const
   {
     return tail[track];
   }
 
-  int16_t getPointer(uint8_t track) const
+  INDEX getPointer(uint8_t track) const
   {
     return pointer[track];
   }
 
-  int16_t getAvailable() const
+  // the node the next insert takes
+  INDEX getAvailable() const
   {
+    if ( available == UNDEFINED && fresh < SIZE )
+      return fresh;
     return available;
   }
 
-  void setPointer(uint8_t track, int16_t index)
+  void setPointer(uint8_t track, INDEX index)
   {
     pointer[track] = index;
   }
 
+  INDEX getLongestGap(uint8_t track) const
+  {
+    return index.getLongestGap(track, buffer, head[track]);
+  }
+
+  // false once the track's checkpoints are to be laid out again
+  bool isIndexed(uint8_t track) const
+  {
+    return !index.isStale(track);
+  }
+
   string traverse(uint8_t track) const
   {
     stringstream result;
-    for ( int16_t index {head[track]};
+    for ( INDEX index {head[track]};
 	  index != UNDEFINED;
 	  index = buffer[index].next)
     {
@@ -305,8 +888,13 @@ public:
   string dump() const
   {
     stringstream result;
-    for (int i {0}; i < min(static_cast<uint16_t>(32), SIZE); i ++ )
+    for (uint32_t i {0}; i < min(static_cast<uint32_t>(32), SIZE); i ++ )
     {
+      if ( i >= fresh )
+      {
+        result << "u:u:? ";
+        continue;
+      }
       if (buffer[i].prev == UNDEFINED)
 	result << 'u';
       else
@@ -0,0 +1,132 @@
+#ifndef CHASE_HPP
+#define CHASE_HPP
+#include <stdint.h>
+#include "Event.hpp"
+
+// controller state a track has reached, so playback started part way
+// through sounds as if it had played from the top
+struct ChaseState
+{
+  static const uint8_t UNSET = 0xFF;
+  static const uint8_t CONTROLLERS = 7;
+  // the first ones select the bank, so they go out ahead of the program
+  static const uint8_t BANK_SELECT = 2;
+
+  uint8_t program;
+  uint8_t controller[CONTROLLERS];
+  uint8_t bend_lsb;
+  uint8_t bend_msb;
+
+  ChaseState()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    program = UNSET;
+    for ( uint8_t i{0}; i < CONTROLLERS; ++i )
+      controller[i] = UNSET;
+    bend_lsb = UNSET;
+    bend_msb = UNSET;
+  }
+
+  // bank select MSB and LSB, modulation, volume, pan, expression and
+  // sustain; MIDIFile keeps every controller, but these are the ones a
+  // track started part way through can't do without
+  static uint8_t getController(const uint8_t i)
+  {
+    static const uint8_t numbers[CONTROLLERS] {0x00, 0x20, 0x01, 0x07, 0x0A, 0x0B, 0x40};
+    return numbers[i];
+  }
+
+  void apply(const Event &event)
+  {
+    switch ( event.getType() )
+    {
+      case Event::ProgChange:
+        program = event.param1;
+        break;
+      case Event::Expression:
+        for ( uint8_t i{0}; i < CONTROLLERS; ++i )
+          if ( getController(i) == event.param1 )
+            controller[i] = event.param2;
+        break;
+      case Event::PitchBend:
+        bend_lsb = event.param1;
+        bend_msb = event.param2;
+        break;
+      default:
+        break;
+    }
+  }
+
+  // calls f with each event needed to restore the state, the bank
+  // before the program it picks from
+  template<class F>
+  void restore(F f) const
+  {
+    for ( uint8_t i{0}; i < BANK_SELECT; ++i )
+      if ( controller[i] != UNSET )
+        f(Event{0, Event::Expression, 0, getController(i), controller[i]});
+    if ( program != UNSET )
+      f(Event{0, Event::ProgChange, 0, program, 0});
+    for ( uint8_t i{BANK_SELECT}; i < CONTROLLERS; ++i )
+      if ( controller[i] != UNSET )
+        f(Event{0, Event::Expression, 0, getController(i), controller[i]});
+    if ( bend_msb != UNSET )
+      f(Event{0, Event::PitchBend, 0, bend_lsb, bend_msb});
+  }
+};
+
+// chase state of every track at every MEASURES-th measure; a seek starts
+// from the snapshot before it and applies at most MEASURES measures of
+// events. Songs longer than SNAPSHOTS * MEASURES scan on from the last
+template<uint8_t TRACKS, uint8_t SNAPSHOTS, uint8_t MEASURES>
+class ChaseCache
+{
+private:
+  ChaseState snapshot[SNAPSHOTS][TRACKS];
+  int32_t position[SNAPSHOTS];
+
+public:
+  uint8_t getSnapshot(const uint16_t measure) const
+  {
+    const uint16_t s = measure / MEASURES;
+    return s < SNAPSHOTS ? s : SNAPSHOTS - 1;
+  }
+
+  // where the snapshot holds: everything before it has been applied
+  int32_t getPosition(const uint8_t s) const
+  {
+    return position[s];
+  }
+
+  const ChaseState &get(const uint8_t s, const uint8_t track) const
+  {
+    return snapshot[s][track];
+  }
+
+  // buffer must visit tracks in order through forEach, map gives
+  // measure positions
+  template<class B, class M>
+  void build(const B &buffer, const M &map)
+  {
+    for ( uint8_t s{0}; s < SNAPSHOTS; ++s )
+      position[s] = map.getMeasurePosition(s * MEASURES);
+    for ( uint8_t t{0}; t < TRACKS; ++t )
+    {
+      ChaseState state;
+      uint8_t s {0};
+      buffer.forEach(t, [&](const Event &event)
+      {
+        while ( s < SNAPSHOTS && event.position >= position[s] )
+          snapshot[s++][t] = state;
+        state.apply(event);
+      });
+      while ( s < SNAPSHOTS )
+        snapshot[s++][t] = state;
+    }
+  }
+};
+#endif
@@ -0,0 +1,646 @@
+#ifndef CHUNKBUFFER_HPP
+#define CHUNKBUFFER_HPP
+#include "Buffer.hpp"
+
+// storage engine with Buffer's interface that keeps each track as a chain
+// of sorted blocks, so playback and seeks walk contiguous memory instead
+// of one link per event. Positions are kept apart from the payloads for
+// the searches; T needs a position member that is not changed in place.
+// SIZE events fit when loaded in order, edits in the middle of a track
+// split blocks and can leave them part full
+template<class T, uint32_t SIZE, uint8_t TRACKS, uint8_t CHECKPOINTS = 0, class INDEX = int16_t>
+class ChunkBuffer
+{
+private:
+  static const uint8_t BLOCK = 16;
+  // a part-filled block at the end of every track
+  static const uint32_t BLOCKS = (SIZE + BLOCK - 1) / BLOCK + TRACKS;
+  static_assert(static_cast<INDEX>(-1) < 0, "UNDEFINED needs a signed index");
+  static_assert(static_cast<uint32_t>(static_cast<INDEX>(BLOCKS - 1)) == BLOCKS - 1,
+                "SIZE does not fit the index type");
+  // counts of entries reach what the blocks hold, past SIZE
+  static_assert(static_cast<uint32_t>(static_cast<INDEX>(BLOCKS * BLOCK)) == BLOCKS * BLOCK,
+                "the entry count does not fit the index type");
+
+  struct Block
+  {
+    INDEX next;
+    INDEX prev;
+    uint8_t count;
+    int32_t position[BLOCK];
+    T data[BLOCK];
+  };
+
+  Block blocks[BLOCKS];
+  INDEX available; // blocks given back
+  uint32_t fresh;  // blocks from here on were never handed out
+  INDEX head[TRACKS];
+  INDEX tail[TRACKS];
+  INDEX pointer[TRACKS]; // block of the playback pointer
+  uint8_t slot[TRACKS];  // and its place in the block
+  INDEX count;
+  INDEX used;            // blocks on a track
+  uint8_t compact_track; // TRACKS between passes
+  INDEX compact_block;   // the next block compact() looks at
+
+  INDEX allocate()
+  {
+    INDEX b {available};
+    if ( b == UNDEFINED )
+    {
+      assert(fresh < BLOCKS);
+      b = fresh++;
+    }
+    else
+      available = blocks[b].next;
+    ++ used;
+    blocks[b].next = UNDEFINED;
+    blocks[b].prev = UNDEFINED;
+    blocks[b].count = 0;
+    return b;
+  }
+
+  void release(const INDEX b)
+  {
+    // an edit freeing the block under compact() ends its track's turn
+    if ( b == compact_block )
+      compact_block = UNDEFINED;
+    -- used;
+    blocks[b].next = available;
+    available = b;
+  }
+
+  void unlink(const uint8_t track, const INDEX b)
+  {
+    Block &block {blocks[b]};
+    if ( block.prev == UNDEFINED )
+      head[track] = block.next;
+    else
+      blocks[block.prev].next = block.next;
+    if ( block.next == UNDEFINED )
+      tail[track] = block.prev;
+    else
+      blocks[block.next].prev = block.prev;
+    release(b);
+  }
+
+  // links a fresh block after b
+  INDEX linkAfter(const uint8_t track, const INDEX b)
+  {
+    const INDEX n {allocate()};
+    blocks[n].prev = b;
+    blocks[n].next = blocks[b].next;
+    if ( blocks[b].next == UNDEFINED )
+      tail[track] = n;
+    else
+      blocks[blocks[b].next].prev = n;
+    blocks[b].next = n;
+    return n;
+  }
+
+  // moves the entries of the block after b onto the end of b
+  void fold(const uint8_t track, const INDEX b)
+  {
+    Block &block {blocks[b]};
+    const INDEX n {block.next};
+    Block &next {blocks[n]};
+    for ( uint8_t j{0}; j < next.count; ++j )
+    {
+      block.position[block.count + j] = next.position[j];
+      block.data[block.count + j] = next.data[j];
+    }
+    if ( pointer[track] == n )
+    {
+      pointer[track] = b;
+      slot[track] += block.count;
+    }
+    block.count += next.count;
+    unlink(track, n);
+  }
+
+  // moves the upper half of a full block into a new one after it
+  void split(const uint8_t track, const INDEX b)
+  {
+    const INDEX n {linkAfter(track, b)};
+    Block &from {blocks[b]};
+    Block &to {blocks[n]};
+    const uint8_t keep = from.count / 2;
+    for ( uint8_t i{keep}; i < from.count; ++i )
+    {
+      to.position[i - keep] = from.position[i];
+      to.data[i - keep] = from.data[i];
+    }
+    to.count = from.count - keep;
+    from.count = keep;
+    if ( pointer[track] == b && slot[track] >= keep )
+    {
+      pointer[track] = n;
+      slot[track] -= keep;
+    }
+  }
+
+  // first slot not before position
+  uint8_t lowerSlot(const Block &block, const int32_t position) const
+  {
+    uint8_t i {0};
+    while ( i < block.count && block.position[i] < position )
+      ++ i;
+    return i;
+  }
+
+  // where insert() puts data: like Buffer, the nearest place to the
+  // playback pointer (or the tail), so equal entries keep their order
+  // relative to what has already played
+  void findSlot(const uint8_t track, const int32_t position, INDEX &b, uint8_t &i) const
+  {
+    b = pointer[track] == UNDEFINED ? tail[track] : pointer[track];
+    i = pointer[track] == UNDEFINED ? blocks[b].count - 1 : slot[track];
+    if ( position >= blocks[b].position[i] )
+    {
+      while ( true )
+      {
+        while ( i < blocks[b].count && blocks[b].position[i] < position )
+          ++ i;
+        if ( i < blocks[b].count || blocks[b].next == UNDEFINED )
+          return;
+        b = blocks[b].next;
+        i = 0;
+      }
+    }
+    while ( true )
+    {
+      while ( i > 0 && blocks[b].position[i - 1] > position )
+        -- i;
+      if ( i > 0 || blocks[b].prev == UNDEFINED )
+        return;
+      b = blocks[b].prev;
+      i = blocks[b].count;
+    }
+  }
+
+  // moves the last entry of b to the front of the block after it
+  void spillRight(const uint8_t track, const INDEX b)
+  {
+    Block &from {blocks[b]};
+    Block &to {blocks[from.next]};
+    for ( uint8_t j{to.count}; j > 0; --j )
+    {
+      to.position[j] = to.position[j - 1];
+      to.data[j] = to.data[j - 1];
+    }
+    -- from.count;
+    to.position[0] = from.position[from.count];
+    to.data[0] = from.data[from.count];
+    ++ to.count;
+    if ( pointer[track] == from.next )
+      ++ slot[track];
+    else if ( pointer[track] == b && slot[track] == from.count )
+    {
+      pointer[track] = from.next;
+      slot[track] = 0;
+    }
+  }
+
+  // moves the first entry of b to the end of the block before it
+  void spillLeft(const uint8_t track, const INDEX b)
+  {
+    Block &from {blocks[b]};
+    Block &to {blocks[from.prev]};
+    to.position[to.count] = from.position[0];
+    to.data[to.count] = from.data[0];
+    ++ to.count;
+    for ( uint8_t j{1}; j < from.count; ++j )
+    {
+      from.position[j - 1] = from.position[j];
+      from.data[j - 1] = from.data[j];
+    }
+    -- from.count;
+    if ( pointer[track] == b )
+    {
+      if ( slot[track] == 0 )
+      {
+        pointer[track] = from.prev;
+        slot[track] = to.count - 1;
+      }
+      else
+        -- slot[track];
+    }
+  }
+
+  // makes room in a full block, preferring its neighbours so blocks stay
+  // full; data in order fills every block
+  void makeRoom(const uint8_t track, INDEX &b, uint8_t &i)
+  {
+    const INDEX next {blocks[b].next};
+    const INDEX prev {blocks[b].prev};
+    if ( i == BLOCK )
+    {
+      if ( next == UNDEFINED || blocks[next].count == BLOCK )
+        linkAfter(track, b);
+      b = blocks[b].next;
+      i = 0;
+    }
+    else if ( next != UNDEFINED && blocks[next].count < BLOCK )
+      spillRight(track, b);
+    else if ( prev != UNDEFINED && blocks[prev].count < BLOCK )
+    {
+      if ( i == 0 )
+      {
+        b = prev;
+        i = blocks[prev].count;
+        return;
+      }
+      spillLeft(track, b);
+      -- i;
+    }
+    else
+    {
+      split(track, b);
+      if ( i > blocks[b].count )
+      {
+        i -= blocks[b].count;
+        b = blocks[b].next;
+      }
+    }
+  }
+
+  const InsertResult<T> insertAt(const uint8_t track, INDEX b, uint8_t i, const T &data)
+  {
+    if ( blocks[b].count == BLOCK )
+      makeRoom(track, b, i);
+    Block &block {blocks[b]};
+    for ( uint8_t j{block.count}; j > i; --j )
+    {
+      block.position[j] = block.position[j - 1];
+      block.data[j] = block.data[j - 1];
+    }
+    block.position[i] = data.position;
+    block.data[i] = data;
+    ++ block.count;
+    if ( pointer[track] == b && slot[track] >= i )
+      ++ slot[track];
+    ++ count;
+    return InsertResult<T>{block.data[i]};
+  }
+
+  // entries of block b before first stay whatever they hold
+  template<class F>
+  INDEX erase(const uint8_t track, INDEX b, uint8_t first, const int32_t from, const T &to, F keep)
+  {
+    INDEX erased {0};
+    bool pointer_erased {false};
+    while ( b != UNDEFINED && blocks[b].position[0] < to.position )
+    {
+      Block &block {blocks[b]};
+      const bool pointer_here {pointer[track] == b};
+      const uint8_t pointer_slot {slot[track]};
+      uint8_t w {0};
+      for ( uint8_t i{0}; i < block.count; ++i )
+      {
+        if ( i >= first && block.position[i] >= from && block.position[i] < to.position &&
+             !keep(block.data[i]) )
+        {
+          pointer_erased |= pointer_here && pointer_slot == i;
+          ++ erased;
+          continue;
+        }
+        if ( pointer_here && pointer_slot == i )
+          slot[track] = w;
+        else if ( pointer_erased )
+        {
+          // first entry left after the pointer's
+          pointer[track] = b;
+          slot[track] = w;
+          pointer_erased = false;
+        }
+        block.position[w] = block.position[i];
+        block.data[w] = block.data[i];
+        ++ w;
+      }
+      block.count = w;
+      first = 0;
+      const INDEX next {block.next};
+      if ( w == 0 )
+        unlink(track, b);
+      b = next;
+    }
+    if ( pointer_erased )
+    {
+      pointer[track] = b;
+      slot[track] = 0;
+    }
+    count -= erased;
+    return erased;
+  }
+
+public:
+  ChunkBuffer()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    for ( uint8_t i{0}; i < TRACKS; ++i )
+    {
+      head[i] = UNDEFINED;
+      tail[i] = UNDEFINED;
+      pointer[i] = UNDEFINED;
+      slot[i] = 0;
+    }
+    available = UNDEFINED;
+    fresh = 0;
+    count = 0;
+    used = 0;
+    compact_track = TRACKS;
+    compact_block = UNDEFINED;
+  }
+
+  void returnToZero(const uint8_t track)
+  {
+    pointer[track] = head[track];
+    slot[track] = 0;
+  }
+
+  bool notUndefined(const uint8_t track) const
+  {
+    return pointer[track] != UNDEFINED;
+  }
+
+  void setUndefined(const uint8_t track)
+  {
+    pointer[track] = UNDEFINED;
+  }
+
+  void next(const uint8_t track)
+  {
+    if ( ++slot[track] == blocks[pointer[track]].count )
+    {
+      pointer[track] = blocks[pointer[track]].next;
+      slot[track] = 0;
+    }
+  }
+
+  T &get(const uint8_t track)
+  {
+    assert(pointer[track] != UNDEFINED);
+    return blocks[pointer[track]].data[slot[track]];
+  }
+
+  // first entry not before data, or the last one when all are
+  void seek(const uint8_t track, const T &data)
+  {
+    if ( head[track] == UNDEFINED )
+      return;
+    INDEX b {head[track]};
+    while ( blocks[b].next != UNDEFINED && data.position > blocks[b].position[blocks[b].count - 1] )
+      b = blocks[b].next;
+    const uint8_t i {lowerSlot(blocks[b], data.position)};
+    pointer[track] = b;
+    slot[track] = i < blocks[b].count ? i : blocks[b].count - 1;
+  }
+
+  const InsertResult<T> insert(const uint8_t track, const T &data)
+  {
+    assert(track < TRACKS);
+    if ( head[track] == UNDEFINED )
+    {
+      head[track] = tail[track] = allocate();
+      InsertResult<T> result {insertAt(track, head[track], 0, data)};
+      pointer[track] = head[track];
+      slot[track] = 0;
+      result.forward = true;
+      return result;
+    }
+    INDEX b;
+    uint8_t i;
+    findSlot(track, data.position, b, i);
+    return insertAt(track, b, i, data);
+  }
+
+  // bulk-load path, searching back from the tail; equal data goes in
+  // front of the trailing run, same as Buffer
+  const InsertResult<T> append(const uint8_t track, const T &data)
+  {
+    assert(track < TRACKS);
+    if ( head[track] == UNDEFINED )
+      return insert(track, data);
+    INDEX b {tail[track]};
+    while ( blocks[b].prev != UNDEFINED && data.position <= blocks[b].position[0] )
+      b = blocks[b].prev;
+    return insertAt(track, b, lowerSlot(blocks[b], data.position), data);
+  }
+
+  // like append(), but equal data goes behind the trailing run, so
+  // entries that must keep the order they came in, e.g. SysEx, do
+  const InsertResult<T> appendAfter(const uint8_t track, const T &data)
+  {
+    assert(track < TRACKS);
+    if ( head[track] == UNDEFINED )
+      return insert(track, data);
+    INDEX b {tail[track]};
+    while ( blocks[b].prev != UNDEFINED && data.position < blocks[b].position[0] )
+      b = blocks[b].prev;
+    uint8_t i {lowerSlot(blocks[b], data.position)};
+    while ( i < blocks[b].count && blocks[b].position[i] == data.position )
+      ++ i;
+    return insertAt(track, b, i, data);
+  }
+
+  // removes the entry under the playback pointer, which moves on to the
+  // one after it
+  void remove(const uint8_t track)
+  {
+    assert(track < TRACKS);
+    if ( head[track] == UNDEFINED )
+      return;
+    const INDEX b {pointer[track]};
+    Block &block {blocks[b]};
+    for ( uint8_t j = slot[track] + 1; j < block.count; ++j )
+    {
+      block.position[j - 1] = block.position[j];
+      block.data[j - 1] = block.data[j];
+    }
+    -- block.count;
+    -- count;
+    if ( slot[track] == block.count )
+    {
+      pointer[track] = block.next;
+      slot[track] = 0;
+    }
+    if ( block.count == 0 )
+    {
+      unlink(track, b);
+      return;
+    }
+    // fold a nearly empty successor back in so blocks stay dense
+    const INDEX n {block.next};
+    if ( n != UNDEFINED && block.count + blocks[n].count <= BLOCK / 2 )
+      fold(track, b);
+  }
+
+  // tops up the track's last block, then fills blocks from the high-water
+  // mark and links them onto the end of the track, read(T &) filling in
+  // each entry, for loading data already in order; false, and nothing
+  // taken, when they do not fit. Loading in several calls packs the
+  // blocks as densely as loading at once
+  template<class F>
+  bool fill(const uint8_t track, const INDEX n, F read)
+  {
+    assert(track < TRACKS);
+    if ( n <= 0 )
+      return true;
+    const INDEX room = tail[track] == UNDEFINED ? 0 : BLOCK - blocks[tail[track]].count;
+    if ( n > room && fresh + (n - room + BLOCK - 1) / BLOCK > BLOCKS )
+      return false;
+    INDEX done {0};
+    if ( room > 0 )
+    {
+      Block &block {blocks[tail[track]]};
+      for ( ; done < n && done < room; ++done )
+      {
+        read(block.data[block.count]);
+        block.position[block.count] = block.data[block.count].position;
+        ++ block.count;
+      }
+    }
+    while ( done < n )
+    {
+      const INDEX b = fresh++;
+      ++ used;
+      Block &block {blocks[b]};
+      block.prev = tail[track];
+      block.next = UNDEFINED;
+      block.count = n - done < BLOCK ? n - done : BLOCK;
+      for ( uint8_t i{0}; i < block.count; ++i )
+      {
+        read(block.data[i]);
+        block.position[i] = block.data[i].position;
+      }
+      if ( tail[track] == UNDEFINED )
+      {
+        head[track] = b;
+        pointer[track] = b;
+        slot[track] = 0;
+      }
+      else
+        blocks[tail[track]].next = b;
+      tail[track] = b;
+      done += block.count;
+    }
+    count += n;
+    return true;
+  }
+
+  // removes the track's entries from from up to before to, except what
+  // keep accepts, rewriting each block it touches once; a pointer on a
+  // removed entry moves on to the next one left
+  template<class F>
+  INDEX eraseRange(const uint8_t track, const T &from, const T &to, F keep)
+  {
+    assert(track < TRACKS);
+    INDEX b {head[track]};
+    while ( b != UNDEFINED && blocks[b].position[blocks[b].count - 1] < from.position )
+      b = blocks[b].next;
+    return erase(track, b, 0, from.position, to, keep);
+  }
+
+  // the same from the playback pointer on, leaving what it passed
+  template<class F>
+  INDEX eraseAhead(const uint8_t track, const T &to, F keep)
+  {
+    assert(track < TRACKS);
+    if ( pointer[track] == UNDEFINED )
+      return 0;
+    const INDEX b {pointer[track]};
+    return erase(track, b, slot[track], blocks[b].position[slot[track]], to, keep);
+  }
+
+  INDEX eraseRange(const uint8_t track, const T &from, const T &to)
+  {
+    return eraseRange(track, from, to, [](const T &) { return false; });
+  }
+
+  // visits the track's entries from from up to before to
+  template<class F>
+  void forEachInRange(const uint8_t track, const T &from, const T &to, F f)
+  {
+    for ( INDEX b {head[track]}; b != UNDEFINED && blocks[b].position[0] < to.position;
+          b = blocks[b].next )
+      for ( uint8_t i{0}; i < blocks[b].count; ++i )
+        if ( blocks[b].position[i] >= from.position && blocks[b].position[i] < to.position )
+          f(blocks[b].data[i]);
+  }
+
+  // folds neighbouring blocks that fit in one, which edits in the middle
+  // of a track leave behind, looking at most at budget blocks a call so
+  // it can run in slices between ticks. True once a pass has finished;
+  // the next call starts another
+  bool compact(uint16_t budget)
+  {
+    for ( ; budget > 0; --budget )
+    {
+      if ( compact_track == TRACKS )
+      {
+        compact_track = 0;
+        compact_block = head[0];
+      }
+      else if ( compact_block == UNDEFINED )
+      {
+        if ( ++ compact_track == TRACKS )
+          return true;
+        compact_block = head[compact_track];
+      }
+      else
+      {
+        const INDEX n {blocks[compact_block].next};
+        // the block stays under the cursor until its next one is too full
+        if ( n != UNDEFINED && blocks[compact_block].count + blocks[n].count <= BLOCK )
+          fold(compact_track, compact_block);
+        else
+          compact_block = n;
+      }
+    }
+    return false;
+  }
+
+  INDEX getCount() const
+  {
+    return count;
+  }
+
+  // blocks on a track, in percent of all of them. Blocks can be part
+  // full, so this runs ahead of the count; under 100 the next insert
+  // always finds a block
+  uint8_t getUsage() const
+  {
+    return static_cast<uint64_t>(used) * 100 / BLOCKS;
+  }
+
+  // visits a track in order without touching its playback pointer
+  template<class F>
+  void forEach(const uint8_t track, F f) const
+  {
+    for ( INDEX b {head[track]}; b != UNDEFINED; b = blocks[b].next )
+      for ( uint8_t i{0}; i < blocks[b].count; ++i )
+        f(blocks[b].data[i]);
+  }
+
+  #ifdef CATCH_CONFIG_MAIN
+  INDEX getBlocks(const uint8_t track) const
+  {
+    INDEX n {0};
+    for ( INDEX b {head[track]}; b != UNDEFINED; b = blocks[b].next )
+      ++ n;
+    return n;
+  }
+
+  string traverse(uint8_t track) const
+  {
+    stringstream result;
+    forEach(track, [&result](const T &data) { result << data; });
+    return result.str();
+  }
+  #endif
+};
+#endif
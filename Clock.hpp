@@ -0,0 +1,69 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+#include <stdint.h>
+
+// schedules ticks against absolute deadlines so neither overruns nor
+// the rounding of tempo / ticks accumulate; the part of a microsecond
+// left over each tick is carried in units of 1/ticks
+template<class Timing>
+class Clock
+{
+private:
+  Timing &timing;
+  uint32_t deadline;
+  uint32_t remainder;
+  int32_t lateness;
+  int32_t max_lateness;
+
+public:
+  Clock(Timing &t) : timing{t}
+  {
+    reset();
+  }
+
+  // the current time becomes the deadline of the first tick
+  void reset()
+  {
+    deadline = timing.getMicroseconds();
+    remainder = 0;
+    lateness = 0;
+    max_lateness = 0;
+  }
+
+  // moves the deadline on by count ticks of tempo microseconds per beat
+  void advance(const uint32_t count, const uint32_t tempo, const uint16_t ticks)
+  {
+    const uint64_t total {static_cast<uint64_t>(count) * tempo + remainder};
+    deadline += total / ticks;
+    remainder = total % ticks;
+  }
+
+  // sleeps until the deadline, returning at once when it has passed so
+  // late ticks catch up
+  void wait()
+  {
+    int32_t left;
+    while ( (left = static_cast<int32_t>(deadline - timing.getMicroseconds())) > 0 )
+      timing.delay(left);
+    lateness = -left;
+    if ( lateness > max_lateness )
+      max_lateness = lateness;
+  }
+
+  uint32_t getDeadline() const
+  {
+    return deadline;
+  }
+
+  // how far past its deadline the last wait() returned
+  int32_t getLateness() const
+  {
+    return lateness;
+  }
+
+  int32_t getMaxLateness() const
+  {
+    return max_lateness;
+  }
+};
+#endif
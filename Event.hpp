@@ -13,6 +13,7 @@ public:
     AfterTouch = 0xD0,
     PitchBend = 0xE0,
     SysEx = 0xF0,
+    Meta = 0xFD,
     Tempo = 0xFE,
     Meter = 0xFF,
   };
@@ -58,7 +59,20 @@ public:
 
   const uint32_t getTempo() const
   {
-    return (param0 << 16 | param1 << 8 | param0);
+    return static_cast<uint32_t>(param0) << 16 | param1 << 8 | param2;
+  }
+
+  // SysEx and Meta events keep their payload in the sequence's arena
+  const uint32_t getOffset() const
+  {
+    return static_cast<uint32_t>(param0) << 16 | param1 << 8 | param2;
+  }
+
+  void setOffset(const uint32_t offset)
+  {
+    param0 = offset >> 16;
+    param1 = offset >> 8;
+    param2 = offset;
   }
 
   bool operator >(const Event &a) const
@@ -111,6 +125,13 @@ ostream& operator<<(ostream &o, const Event& event)
       o << "Meter," << static_cast<int>(event.param0) << "/"
         << static_cast<int>(event.param1);
       break;
+    // the params only hold where the payload is
+    case Event::SysEx:
+      o << "SysEx";
+      break;
+    case Event::Meta:
+      o << "Meta";
+      break;
     default:
       o << static_cast<int>(event.getType())
         << "," << static_cast<int>(event.param1)
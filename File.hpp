@@ -9,10 +9,40 @@ public:
 
   virtual uint8_t readByte() = 0;
 
-  virtual void read(uint32_t length, uint8_t *data) = 0;
+  // returns the number of bytes actually read
+  virtual uint32_t read(uint32_t length, uint8_t *data) = 0;
 
   virtual uint32_t getPosition() = 0;
 
   virtual void seek(int32_t position) = 0;
+
+  // files already held in memory expose their bytes so readers can
+  // parse them in place
+  virtual const uint8_t *getData()
+  {
+    return 0;
+  }
+
+  virtual uint32_t getSize()
+  {
+    return 0;
+  }
+};
+
+// the writable counterpart, for saving to disk or SD card
+class KOutFile
+{
+public:
+  virtual bool isValid() = 0;
+
+  virtual void close() = 0;
+
+  // returns the number of bytes actually written
+  virtual uint32_t write(uint32_t length, const uint8_t *data) = 0;
+
+  virtual uint32_t getPosition() = 0;
+
+  // absolute, unlike KFile::seek, for going back to fill in a length
+  virtual void seek(uint32_t position) = 0;
 };
 #endif
@@ -0,0 +1,170 @@
+#ifndef FILEREADER_HPP
+#define FILEREADER_HPP
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+#include "File.hpp"
+
+// reads a KFile a block at a time so parsing costs no virtual call,
+// syscall or SPI transaction per byte; memory-backed files and plain
+// spans are parsed in place without copying
+template<uint16_t SIZE = 512>
+class FileReader
+{
+private:
+  KFile *fp;
+  uint8_t block[SIZE];
+  const uint8_t *data;
+  uint32_t index;
+  uint32_t fill;
+  uint32_t position; // file offset of data[0]
+  bool shared;       // other readers move the file too
+
+  bool refill()
+  {
+    if ( data != block )
+      return false;
+    position += fill;
+    index = 0;
+    if ( shared )
+      fp->seek(static_cast<int32_t>(position - fp->getPosition()));
+    fill = fp->read(SIZE, block);
+    return fill > 0;
+  }
+
+public:
+  FileReader(KFile &f)
+    : fp{&f}, data{f.getData()}, index{0}, fill{0}, position{0}, shared{false}
+  {
+    if ( data )
+    {
+      index = f.getPosition();
+      fill = f.getSize();
+    }
+    else
+    {
+      data = block;
+      position = f.getPosition();
+    }
+  }
+
+  FileReader(const uint8_t *span, const uint32_t size)
+    : fp{0}, data{span}, index{0}, fill{size}, position{0}, shared{false}
+  {
+  }
+
+  // reads nothing until attached
+  FileReader() : fp{0}, data{block}, index{0}, fill{0}, position{0}, shared{false}
+  {
+  }
+
+  // reads f from offset on, taking turns with other readers of f: the
+  // file is put back where this one left off before each block is read
+  void attach(KFile &f, const uint32_t offset)
+  {
+    fp = &f;
+    data = f.getData();
+    shared = true;
+    if ( data )
+    {
+      index = offset;
+      fill = f.getSize();
+      position = 0;
+    }
+    else
+    {
+      data = block;
+      index = 0;
+      fill = 0;
+      position = offset;
+    }
+  }
+
+  uint8_t readByte()
+  {
+    if ( index == fill && !refill() )
+      return 0;
+    return data[index++];
+  }
+
+  uint8_t peek()
+  {
+    if ( index == fill && !refill() )
+      return 0;
+    return data[index];
+  }
+
+  // steps back over the last byte read
+  void unread()
+  {
+    assert(index > 0);
+    -- index;
+  }
+
+  uint32_t read(uint32_t length, uint8_t *out)
+  {
+    uint32_t done {0};
+    while ( done < length )
+    {
+      if ( index == fill && !refill() )
+        break;
+      uint32_t n {static_cast<uint32_t>(fill - index)};
+      if ( n > length - done )
+        n = length - done;
+      memcpy(out + done, data + index, n);
+      index += n;
+      done += n;
+    }
+    return done;
+  }
+
+  // relative, like KFile::seek, but free when it stays inside the block
+  void skip(const int32_t offset)
+  {
+    const int32_t target {static_cast<int32_t>(index) + offset};
+    if ( target >= 0 && target <= static_cast<int32_t>(fill) )
+    {
+      index = target;
+      return;
+    }
+    if ( data != block )
+    {
+      index = target < 0 ? 0 : fill;
+      return;
+    }
+    if ( !shared )
+      fp->seek(target - fill);
+    position += target;
+    index = 0;
+    fill = 0;
+  }
+
+  uint32_t getPosition() const
+  {
+    return position + index;
+  }
+
+  int32_t readInt(uint8_t length)
+  {
+    int32_t value = 0;
+    while (length --)
+      value = (value << 8) + readByte();
+    return value;
+  }
+
+  int32_t readVarLength()
+  {
+    int32_t value;
+    uint8_t c;
+    if ( (value = readByte()) & 0x80 )
+    {
+      value &= 0x7f;
+      do
+      {
+        value = (value << 7) + ((c = readByte()) & 0x7f);
+      } while (c & 0x80);
+    }
+    return value;
+  }
+};
+#endif
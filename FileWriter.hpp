@@ -0,0 +1,108 @@
+#ifndef FILEWRITER_HPP
+#define FILEWRITER_HPP
+#include <stdint.h>
+#include <string.h>
+#include "File.hpp"
+
+// writes a KOutFile a block at a time so encoding costs no virtual call,
+// syscall or SPI transaction per byte
+template<uint16_t SIZE = 512>
+class FileWriter
+{
+private:
+  KOutFile *fp;
+  uint8_t block[SIZE];
+  uint16_t fill;
+  uint32_t position; // file offset of block[0]
+  bool failed;
+
+public:
+  FileWriter(KOutFile &f)
+    : fp{&f}, fill{0}, position{f.getPosition()}, failed{false}
+  {
+  }
+
+  ~FileWriter()
+  {
+    flush();
+  }
+
+  void flush()
+  {
+    if ( fill && fp->write(fill, block) != fill )
+      failed = true;
+    position += fill;
+    fill = 0;
+  }
+
+  void writeByte(const uint8_t byte)
+  {
+    if ( fill == SIZE )
+      flush();
+    block[fill++] = byte;
+  }
+
+  void write(uint32_t length, const uint8_t *data)
+  {
+    while ( length )
+    {
+      if ( fill == SIZE )
+        flush();
+      uint32_t n {static_cast<uint32_t>(SIZE - fill)};
+      if ( n > length )
+        n = length;
+      memcpy(block + fill, data, n);
+      fill += n;
+      data += n;
+      length -= n;
+    }
+  }
+
+  uint32_t getPosition() const
+  {
+    return position + fill;
+  }
+
+  // big-endian, as in MIDI files
+  void writeInt(const uint32_t value, uint8_t length)
+  {
+    while ( length -- )
+      writeByte(value >> (8 * length));
+  }
+
+  void writeVarLength(const uint32_t value)
+  {
+    uint8_t shift {28};
+    while ( shift > 0 && !(value >> shift) )
+      shift -= 7;
+    for ( ; shift > 0; shift -= 7 )
+      writeByte(0x80 | ((value >> shift) & 0x7F));
+    writeByte(value & 0x7F);
+  }
+
+  // overwrites what was written at an earlier position, e.g. a length
+  // only known afterwards
+  void patchInt(const uint32_t at, const uint32_t value, const uint8_t length)
+  {
+    if ( at >= position )
+    {
+      for ( uint8_t i{0}; i < length; ++i )
+        block[at - position + i] = value >> (8 * (length - 1 - i));
+      return;
+    }
+    flush();
+    uint8_t bytes[4];
+    for ( uint8_t i{0}; i < length; ++i )
+      bytes[i] = value >> (8 * (length - 1 - i));
+    fp->seek(at);
+    if ( fp->write(length, bytes) != length )
+      failed = true;
+    fp->seek(position);
+  }
+
+  bool hasFailed() const
+  {
+    return failed;
+  }
+};
+#endif
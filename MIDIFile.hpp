@@ -2,37 +2,58 @@
 #define MIDIFILE_HPP
 #include "Sequence.hpp"
 #include "File.hpp"
+#include "FileReader.hpp"
 
 class MIDIFile
 {
 private:
   KFile &fp;
+  FileReader<> reader;
+  // where a sliced import is up to
+  int16_t tracks_left;
+  uint32_t track_end;
+  int32_t track_time;
+  uint8_t status;
 
-  int32_t read_int(uint8_t length)
+  // drops channels the sequence has no track for
+  template<class S>
+  struct TrackFilter
   {
-    int32_t value = 0;
-    while (length --)
-      value = (value << 8) + fp.readByte();
-    return value;
-  }
+    S &sequence;
 
-  int32_t read_varlength()
+    void appendEvent(const uint8_t track, const Event &event)
+    {
+      if ( track < S::TRACKS )
+        sequence.appendEvent(track, event);
+    }
+
+    uint8_t *appendPayload(const uint8_t track, const Event &event, const uint16_t length)
+    {
+      return track < S::TRACKS ? sequence.appendPayload(track, event, length) : 0;
+    }
+  };
+
+  // reads size bytes into a payload behind prefix, if there is one, or
+  // skips them when the sink has no room
+  template<class Reader, class Sink>
+  static void readPayload(Reader &reader, Sink &sink, const Event &event,
+                          const int16_t prefix, const uint32_t size)
   {
-    int32_t value;
-    uint8_t c;
-    if ( (value = fp.readByte()) & 0x80 )
+    const uint32_t length {size + (prefix < 0 ? 0 : 1)};
+    uint8_t *payload {length <= UINT16_MAX ? sink.appendPayload(TEMPO_TRACK, event, length) : 0};
+    if ( !payload )
     {
-      value &= 0x7f;
-      do
-      {
-        value = (value << 7) + ((c = fp.readByte()) & 0x7f);
-      } while (c & 0x80);
+      reader.skip(size);
+      return;
     }
-    return value;
+    if ( prefix >= 0 )
+      *payload++ = prefix;
+    reader.read(size, payload);
   }
 
 public:
-  MIDIFile(KFile &fp) : fp{fp}
+  MIDIFile(KFile &fp)
+    : fp{fp}, reader{fp}, tracks_left{0}, track_end{0}, track_time{0}, status{0}
   {
   }
 
@@ -41,147 +62,183 @@ public:
     fp.close();
   }
 
-  int8_t import(Sequence &sequence)
+  // decodes the event at the reader, handing it to sink.appendEvent(),
+  // or for SysEx and meta data to sink.appendPayload(); track_time and
+  // status carry over from the event before
+  template<class Reader, class Sink>
+  static int8_t decodeEvent(Reader &reader, int32_t &track_time, uint8_t &status, Sink &sink)
   {
-    sequence.clear();
-    // header
-    fp.seek(8); // MThd, size
-    int16_t format = read_int(2);
-    int16_t tracks = read_int(2);
-    int16_t ticks = read_int(2);
-    sequence.setTicks(ticks);
-    // tracks
-    for ( int16_t i = 0; i < tracks; i ++ )
+    uint8_t event, channel;
+    uint8_t param1, param2;
+
+    int32_t delta_time = reader.readVarLength();
+    track_time += delta_time;
+
+    // running status leaves the status byte out
+    if (reader.peek() & 0x80)
+      status = reader.readByte();
+
+    event = status & 0xF0;
+    channel = status & 0x0F;
+
+    uint32_t size, type;
+    switch ( event )
     {
-	uint8_t track_name[80];
-        uint32_t track_size, track_pos;
-	// track header
-	fp.seek(4); // MTrk
-	track_size = read_int(4);
-	track_pos = fp.getPosition();
-	
-	// events
-	int32_t track_time = 0;
-	uint8_t status = 0;
-	while (fp.getPosition() < track_pos+track_size)
-	{
-	  uint8_t event, channel;
-	  uint8_t param1, param2;
-	  
-	  int32_t delta_time = read_varlength();
-	  track_time += delta_time;
-	  
-	  uint8_t peak_ahead = fp.readByte();
-	  if (peak_ahead & 0x80)
-	    status = peak_ahead;
-	  else
-	    fp.seek(-1);
-	  
-	  event = status & 0xF0;
-	  channel = status & 0x0F;
-	  
-	  uint32_t size, type;
-	  switch ( event )
-	  {
-	    case Event::NoteOff:
-	      param1 = fp.readByte();
-	      param2 = fp.readByte();
-	      sequence.addEvent(channel+1, Event{track_time, Event::NoteOff, 0, param1, 0});
-	      break;
-	    case Event::NoteOn:
-	      param1 = fp.readByte();
-	      param2 = fp.readByte();
-	      if (param2)
-		sequence.addEvent(channel+1, Event{track_time, Event::NoteOn, 0, param1, param2});
-	      else
-		sequence.addEvent(channel+1, Event{track_time, Event::NoteOff, 0, param1, 0});
-	      break;
-	    case Event::PolyAfter:
-	      param1 = fp.readByte();
-	      param2 = fp.readByte();
-	      break;
-	    case Event::Expression:
-	      param1 = fp.readByte();
-	      param2 = fp.readByte();
-	      switch ( param1 )
-	      {
-		case 0x01: // modulation
-		case 0x07: // volume
-		case 0x0A: // pan
-		case 0x40: // sustain pedal
-		  sequence.addEvent(channel+1, Event{track_time, Event::Expression, 0, param1, param2});
-		  break;
-	      }
-	      break;
-	    case Event::ProgChange:
-	      param1 = fp.readByte();
-	      sequence.addEvent(channel+1, Event{track_time, Event::ProgChange, 0, param1, 0});
-	      break;
-	    case Event::AfterTouch:
-	      param1 = fp.readByte();
-	      break;
-	    case Event::PitchBend:
-	      param1 = fp.readByte();
-	      param2 = fp.readByte();
-	      sequence.addEvent(channel+1, Event{track_time, Event::PitchBend, 0, param1, param2});
-	      break;
-	    case Event::SysEx:
-	      switch ( channel )
-	      {
-		// SysEx Event
-		case 0x0:
-		case 0x7:
-			break;
-		// Meta Event
-		case 0xF: 
-		  type = fp.readByte();
-		  size = read_varlength();
-		  switch ( type )
-		  {
-		    case 0x51:
-		      sequence.addEvent(TEMPO_TRACK, Event{track_time, Event::Tempo, fp.readByte(), fp.readByte(), fp.readByte()});
-		      break;
-		    case 0x58:
-		      sequence.addEvent(TEMPO_TRACK, Event{track_time, Event::Meter, fp.readByte(),
-					      static_cast<uint8_t>(1 << fp.readByte()), fp.readByte()});
-		      fp.readByte(); // ignore # of 1/32nd notes per 24 MIDI clocks
-		      break;
-		    case 0x03:
-		      // track name
-		      fp.read(size < sizeof(track_name) ? size : sizeof(track_name), track_name);
-		      track_name[size] = 0;
-		      break;
-			    
-		    case 0x00:
-			    // sequence number
-		    case 0x01:
-			    // text event
-		    case 0x04:
-			    // instrument name
-		    case 0x06:
-			    // marker
-		    case 0x20:
-			    // midi channel prefix
-		    case 0x54:
-			    // SMTPE offset
-		    case 0x59:
-			    // key signature
-		    case 0x2f:
-			    // end of track
-		    default:
-			    fp.seek(size);
-	      }
-	      break;
-	    default:
-	      return -3;
-	  }
-	  break;
-	default:
-	  return -4;
-      }
+      case Event::NoteOff:
+        param1 = reader.readByte();
+        param2 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::NoteOff, 0, param1, 0});
+        break;
+      case Event::NoteOn:
+        param1 = reader.readByte();
+        param2 = reader.readByte();
+        if (param2)
+          sink.appendEvent(channel+1, Event{track_time, Event::NoteOn, 0, param1, param2});
+        else
+          sink.appendEvent(channel+1, Event{track_time, Event::NoteOff, 0, param1, 0});
+        break;
+      case Event::PolyAfter:
+        param1 = reader.readByte();
+        param2 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::PolyAfter, 0, param1, param2});
+        break;
+      case Event::Expression:
+        param1 = reader.readByte();
+        param2 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::Expression, 0, param1, param2});
+        break;
+      case Event::ProgChange:
+        param1 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::ProgChange, 0, param1, 0});
+        break;
+      case Event::AfterTouch:
+        param1 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::AfterTouch, 0, param1, 0});
+        break;
+      case Event::PitchBend:
+        param1 = reader.readByte();
+        param2 = reader.readByte();
+        sink.appendEvent(channel+1, Event{track_time, Event::PitchBend, 0, param1, param2});
+        break;
+      case Event::SysEx:
+        switch ( channel )
+        {
+          // SysEx Event, stored as the bytes to send
+          case 0x0:
+            size = reader.readVarLength();
+            readPayload(reader, sink, Event{track_time, Event::SysEx, 0, 0, 0}, 0xF0, size);
+            break;
+          // escaped bytes, sent as they are
+          case 0x7:
+            size = reader.readVarLength();
+            readPayload(reader, sink, Event{track_time, Event::SysEx, 0, 0, 0}, -1, size);
+            break;
+          // Meta Event
+          case 0xF:
+            type = reader.readByte();
+            size = reader.readVarLength();
+            switch ( type )
+            {
+              case 0x51:
+                sink.appendEvent(TEMPO_TRACK, Event{track_time, Event::Tempo, reader.readByte(), reader.readByte(), reader.readByte()});
+                break;
+              case 0x58:
+                sink.appendEvent(TEMPO_TRACK, Event{track_time, Event::Meter, reader.readByte(),
+                                        static_cast<uint8_t>(1 << reader.readByte()), reader.readByte()});
+                reader.readByte(); // ignore # of 1/32nd notes per 24 MIDI clocks
+                break;
+              case 0x20:
+                // midi channel prefix
+              case 0x21:
+                // midi port
+              case 0x2f:
+                // end of track
+                reader.skip(size);
+                break;
+
+              // names, text, markers, key signatures and the rest are
+              // kept for saving, their type in front of their data
+              default:
+                readPayload(reader, sink, Event{track_time, Event::Meta, 0, 0, 0}, type, size);
+            }
+            break;
+          default:
+            return -3;
+        }
+        break;
+      default:
+        return -4;
     }
+    return 0;
+  }
+
+  // decodes one MTrk body, handing each event to sink.appendEvent()
+  template<class Reader, class Sink>
+  static int8_t decodeTrack(Reader &reader, const uint32_t end, Sink &sink)
+  {
+    int32_t track_time = 0;
+    uint8_t status = 0;
+    while (reader.getPosition() < end)
+    {
+      const int8_t result {decodeEvent(reader, track_time, status, sink)};
+      if ( result )
+        return result;
     }
     return 0;
   }
+
+  // reads the header and clears the sequence for importSlice()
+  template<class S>
+  void beginImport(S &sequence)
+  {
+    sequence.clear();
+    reader.skip(8); // MThd, size
+    reader.readInt(2); // format
+    tracks_left = reader.readInt(2);
+    sequence.setTicks(reader.readInt(2));
+    track_end = reader.getPosition();
+  }
+
+  // decodes at most budget events, so a song can be loaded a little at a
+  // time while another plays. 1 while there is more to read, 0 once the
+  // sequence is complete, negative on a broken file
+  template<class S>
+  int8_t importSlice(S &sequence, uint16_t budget)
+  {
+    TrackFilter<S> sink {sequence};
+    while ( budget -- )
+    {
+      if ( reader.getPosition() >= track_end )
+      {
+        if ( tracks_left <= 0 )
+        {
+          // appending leaves each pointer wherever the first event landed
+          for ( uint8_t t {0}; t < S::TRACKS; ++t )
+            sequence.returnToZero(t);
+          return 0;
+        }
+        -- tracks_left;
+        reader.skip(4); // MTrk
+        const uint32_t track_size = reader.readInt(4);
+        track_end = reader.getPosition() + track_size;
+        track_time = 0;
+        status = 0;
+        continue;
+      }
+      const int8_t result {decodeEvent(reader, track_time, status, sink)};
+      if ( result )
+        return result;
+    }
+    return 1;
+  }
+
+  template<class S>
+  int8_t import(S &sequence)
+  {
+    beginImport(sequence);
+    int8_t result;
+    while ( (result = importSlice(sequence, UINT16_MAX)) > 0 );
+    return result;
+  }
 };
 #endif
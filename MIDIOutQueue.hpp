@@ -0,0 +1,100 @@
+#ifndef MIDIOUTQUEUE_HPP
+#define MIDIOUTQUEUE_HPP
+#include <stdint.h>
+#include "Event.hpp"
+
+// bytes waiting for a serial MIDI line, encoded with running status:
+// the status byte is left out while it repeats the last one sent
+template<uint16_t SIZE>
+class MIDIOutQueue
+{
+private:
+  uint8_t data[SIZE];
+  uint16_t head;
+  uint16_t count;
+  uint8_t running_status;
+  uint32_t dropped;
+
+  void put(const uint8_t byte)
+  {
+    data[(head + count++) % SIZE] = byte;
+  }
+
+public:
+  // 10 bits a byte at 31250 baud
+  static const uint16_t BYTE_MICROSECONDS = 320;
+
+  MIDIOutQueue() : head{0}, count{0}, running_status{0}, dropped{0}
+  {
+  }
+
+  // false, and nothing queued, when the message does not fit
+  bool push(const uint8_t channel, const Event &event)
+  {
+    const uint8_t status = event.getType() | channel;
+    const bool short_message {event.getType() == Event::ProgChange ||
+                              event.getType() == Event::AfterTouch};
+    const uint8_t length = (status == running_status ? 0 : 1) + (short_message ? 1 : 2);
+    if ( SIZE - count < length )
+    {
+      dropped ++;
+      return false;
+    }
+    if ( status != running_status )
+      put(status);
+    put(event.param1);
+    if ( !short_message )
+      put(event.param2);
+    running_status = status;
+    return true;
+  }
+
+  // queues as many of the bytes as fit and returns how many; they cancel
+  // running status
+  uint16_t pushBytes(const uint8_t *bytes, const uint16_t length)
+  {
+    uint16_t n {0};
+    while ( n < length && count < SIZE )
+      put(bytes[n++]);
+    if ( n )
+      running_status = 0;
+    return n;
+  }
+
+  // the next message carries its status byte again, e.g. after other
+  // bytes went out on the line
+  void clearRunningStatus()
+  {
+    running_status = 0;
+  }
+
+  bool isEmpty() const
+  {
+    return count == 0;
+  }
+
+  uint16_t getCount() const
+  {
+    return count;
+  }
+
+  uint8_t pop()
+  {
+    const uint8_t byte {data[head]};
+    head = (head + 1) % SIZE;
+    count --;
+    return byte;
+  }
+
+  // wire time of everything still queued
+  uint32_t getBacklog() const
+  {
+    return static_cast<uint32_t>(count) * BYTE_MICROSECONDS;
+  }
+
+  uint32_t getDropped() const
+  {
+    return dropped;
+  }
+};
+#endif
@@ -6,6 +6,27 @@ class MIDIPort
 {
 public:
   virtual void send(const uint8_t channel, const Event &event) = 0;
+
+  // a whole SysEx message, F0 to F7; ports that can't send it drop it
+  virtual void sendSysEx(const uint8_t *data, const uint16_t length)
+  {
+  }
+
+  // sends between beginTick() and flush() may be held back and handed
+  // to the driver together; outside of them they go out at once
+  virtual void beginTick()
+  {
+  }
+
+  virtual void flush()
+  {
+  }
+
+  // microseconds of output sent but not yet on the wire
+  virtual uint32_t getBacklog() const
+  {
+    return 0;
+  }
 };
 
 #endif
@@ -0,0 +1,259 @@
+#ifndef MIDISTREAM_HPP
+#define MIDISTREAM_HPP
+#include <stdint.h>
+#include "Sequence.hpp"
+#include "File.hpp"
+#include "FileReader.hpp"
+#include "MIDIFile.hpp"
+
+// plays a MIDI file longer than the sequence holds: each MTrk chunk gets
+// a cursor of its own, and the events are merged in time order into the
+// sequence only as far as a lookahead past the playhead, while what has
+// been played is dropped. Memory stays at the sequence, the cursors'
+// blocks and a small batch, however long the song. Reading the file
+// (prefetch) and changing the sequence (commit) are separate steps, so on
+// the device only the commit has to hold off the tick. SysEx and meta
+// data are read straight into the sequence's arena, where nothing else
+// allocates, and given back as their events are dropped. Streamed songs
+// play once from the top; tracks should not loop, and seeking or playing
+// again means opening the stream again
+template<uint8_t CHUNKS = 16, uint16_t BLOCK = 64>
+class MIDIStream
+{
+private:
+  static const uint8_t BATCH = 16;
+
+  // takes the one event decodeEvent() may hand out
+  struct Pending
+  {
+    uint8_t track;
+    Event event;
+    bool ready;
+    Arena<ARENA_SIZE> *arena;
+    uint32_t *dropped;
+
+    void appendEvent(const uint8_t t, const Event &e)
+    {
+      track = t;
+      event = e;
+      ready = true;
+    }
+
+    uint8_t *appendPayload(const uint8_t t, const Event &e, const uint16_t length)
+    {
+      const uint32_t offset {arena->allocate(length)};
+      if ( offset == Arena<ARENA_SIZE>::UNDEFINED )
+      {
+        ++ *dropped;
+        return 0;
+      }
+      Event stored {e};
+      stored.setOffset(offset);
+      appendEvent(t, stored);
+      return arena->getPayload(offset);
+    }
+  };
+
+  struct Cursor
+  {
+    FileReader<BLOCK> reader;
+    uint32_t end;
+    int32_t track_time;
+    uint8_t status;
+    Pending next;
+  };
+
+  struct Queued
+  {
+    uint8_t track;
+    Event event;
+  };
+
+  KFile &fp;
+  Cursor cursors[CHUNKS];
+  uint8_t chunks;
+  uint16_t ticks;
+  int32_t lookahead;
+  Queued batch[BATCH];
+  uint8_t batched;
+  uint8_t committed;
+  uint32_t dropped;
+
+  // decodes the chunk's next event that goes into a sequence
+  int8_t advance(Cursor &cursor)
+  {
+    cursor.next.ready = false;
+    while ( !cursor.next.ready && cursor.reader.getPosition() < cursor.end )
+    {
+      const uint32_t at {cursor.reader.getPosition()};
+      const int8_t result {MIDIFile::decodeEvent(cursor.reader, cursor.track_time,
+                                                 cursor.status, cursor.next)};
+      if ( result )
+        return result;
+      // a file cut short ends the chunk
+      if ( cursor.reader.getPosition() == at )
+      {
+        cursor.next.ready = false;
+        cursor.end = at;
+      }
+    }
+    return 0;
+  }
+
+public:
+  MIDIStream(KFile &fp)
+    : fp{fp}, chunks{0}, ticks{24}, lookahead{0}, batched{0}, committed{0}, dropped{0}
+  {
+  }
+
+  ~MIDIStream()
+  {
+    fp.close();
+  }
+
+  // indexes the chunks and clears the sequence for the first refill.
+  // -1 when the file is no MIDI file, -2 with more chunks than CHUNKS,
+  // or what decoding the first events returned
+  template<class S>
+  int8_t open(S &sequence, const uint8_t lookahead_measures = 4)
+  {
+    if ( !fp.isValid() )
+      return -1;
+    FileReader<BLOCK> &header {cursors[0].reader};
+    header.attach(fp, 0);
+    uint8_t magic[4];
+    if ( header.read(4, magic) != 4 || magic[0] != 'M' || magic[1] != 'T' ||
+         magic[2] != 'h' || magic[3] != 'd' )
+      return -1;
+    const uint32_t header_size = header.readInt(4);
+    header.readInt(2); // format
+    const int16_t tracks = header.readInt(2);
+    ticks = header.readInt(2);
+    if ( tracks > CHUNKS )
+      return -2;
+    uint32_t offset {8 + header_size};
+    chunks = tracks > 0 ? tracks : 0;
+    for ( uint8_t i {0}; i < chunks; ++i )
+    {
+      // only the chunk headers are read here
+      header.attach(fp, offset);
+      header.skip(4); // MTrk
+      const uint32_t size = header.readInt(4);
+      cursors[i].end = offset + 8 + size;
+      offset = cursors[i].end;
+    }
+    // each body starts after its chunk header; their first payloads go
+    // into the arena already
+    sequence.clear();
+    offset = 8 + header_size;
+    for ( uint8_t i {0}; i < chunks; ++i )
+    {
+      Cursor &cursor {cursors[i]};
+      cursor.reader.attach(fp, offset + 8);
+      cursor.track_time = 0;
+      cursor.status = 0;
+      cursor.next.arena = &sequence.getArena();
+      cursor.next.dropped = &dropped;
+      offset = cursor.end;
+      const int8_t result {advance(cursor)};
+      if ( result )
+        return result;
+    }
+    sequence.setTicks(ticks);
+    // as measures of 4/4, tempo and meter are only known once played
+    lookahead = static_cast<int32_t>(lookahead_measures) * 4 * ticks;
+    batched = 0;
+    committed = 0;
+    return 0;
+  }
+
+  // reads events due before playhead + lookahead into the batch, merging
+  // the chunks by time. Only touches the file, never the sequence. False
+  // when there was nothing to read
+  bool prefetch(const int32_t playhead)
+  {
+    if ( committed == batched )
+      batched = committed = 0;
+    const uint8_t before {batched};
+    while ( batched < BATCH )
+    {
+      Cursor *first {0};
+      for ( uint8_t i {0}; i < chunks; ++i )
+        if ( cursors[i].next.ready &&
+             (!first || cursors[i].next.event.position < first->next.event.position) )
+          first = &cursors[i];
+      if ( !first || first->next.event.position > playhead + lookahead )
+        break;
+      batch[batched++] = Queued{first->next.track, first->next.event};
+      if ( advance(*first) )
+        first->next.ready = false;
+    }
+    return batched > before;
+  }
+
+  // drops the events played before playhead and adds the batch, as far as
+  // the sequence has room. Does no reading, so it is short enough to run
+  // with the tick held off. While payloads are still being sent drop is
+  // false and what was played stays; a track that had run dry then goes
+  // on from the first added event due at playhead
+  template<class S>
+  void commit(S &sequence, const int32_t playhead, const bool drop = true)
+  {
+    if ( drop )
+    {
+      sequence.forEachInRange(TEMPO_TRACK, INT32_MIN, playhead, [&](const Event &event)
+      {
+        if ( event.getType() == Event::SysEx || event.getType() == Event::Meta )
+          sequence.getArena().release(event.getOffset());
+      });
+      for ( uint8_t t {0}; t < S::TRACKS; ++t )
+        sequence.eraseRange(t, INT32_MIN, playhead);
+    }
+    bool dry[S::TRACKS];
+    bool added[S::TRACKS];
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+    {
+      dry[t] = !sequence.notUndefined(t);
+      added[t] = false;
+    }
+    while ( committed < batched && sequence.getUsage() < 100 )
+    {
+      const Queued &queued {batch[committed++]};
+      if ( queued.track < S::TRACKS )
+      {
+        sequence.appendEvent(queued.track, queued.event);
+        added[queued.track] = true;
+      }
+    }
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+      if ( dry[t] && added[t] )
+        sequence.resume(t, playhead);
+  }
+
+  // both steps, until the lookahead is covered or the sequence is full
+  template<class S>
+  void refill(S &sequence, const int32_t playhead)
+  {
+    commit(sequence, playhead);
+    while ( committed == batched && prefetch(playhead) )
+      commit(sequence, playhead);
+  }
+
+  // SysEx and meta events left out because the arena was full
+  uint32_t getDropped() const
+  {
+    return dropped;
+  }
+
+  // true once every chunk is read and committed
+  bool isFinished() const
+  {
+    if ( committed < batched )
+      return false;
+    for ( uint8_t i {0}; i < chunks; ++i )
+      if ( cursors[i].next.ready )
+        return false;
+    return true;
+  }
+};
+#endif
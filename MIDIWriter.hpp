@@ -0,0 +1,170 @@
+#ifndef MIDIWRITER_HPP
+#define MIDIWRITER_HPP
+#include "Sequence.hpp"
+#include "File.hpp"
+#include "FileWriter.hpp"
+
+// saves a sequence as a format 1 MIDI file, the tempo track first and a
+// track per channel that has events. Each track is walked once and goes
+// straight through the writer's block, its length filled in after, so
+// saving needs no copy of the events
+class MIDIWriter
+{
+private:
+  KOutFile &fp;
+  FileWriter<> writer;
+  int32_t track_time;
+  uint8_t status;
+  uint32_t track_start; // of the MTrk length, 0 before the first event
+
+  void beginTrack()
+  {
+    writer.write(4, reinterpret_cast<const uint8_t *>("MTrk"));
+    track_start = writer.getPosition();
+    writer.writeInt(0, 4);
+    track_time = 0;
+    status = 0;
+  }
+
+  void endTrack()
+  {
+    writeMeta(track_time, 0x2F, 0);
+    writer.patchInt(track_start, writer.getPosition() - track_start - 4, 4);
+    track_start = 0;
+  }
+
+  void writeMeta(const int32_t time, const uint8_t type, const uint32_t length)
+  {
+    writer.writeVarLength(time - track_time);
+    track_time = time;
+    writer.writeByte(0xFF);
+    writer.writeByte(type);
+    writer.writeVarLength(length);
+    // meta events cancel running status
+    status = 0;
+  }
+
+  template<class S>
+  void writeEvent(const S &sequence, const uint8_t channel, const Event &event)
+  {
+    uint16_t length;
+    const uint8_t *payload;
+    switch ( event.getType() )
+    {
+      case Event::Tempo:
+        writeMeta(event.position, 0x51, 3);
+        writer.writeByte(event.param0);
+        writer.writeByte(event.param1);
+        writer.writeByte(event.param2);
+        return;
+      case Event::Meter:
+        {
+          uint8_t power {0};
+          while ( (1 << power) < event.param1 )
+            ++ power;
+          writeMeta(event.position, 0x58, 4);
+          writer.writeByte(event.param0);
+          writer.writeByte(power);
+          writer.writeByte(event.param2);
+          writer.writeByte(8);
+        }
+        return;
+      case Event::SysEx:
+        payload = sequence.getPayload(event, length);
+        if ( length == 0 )
+          return;
+        writer.writeVarLength(event.position - track_time);
+        track_time = event.position;
+        // F0 messages are stored whole, anything else is escaped
+        if ( payload[0] == 0xF0 )
+        {
+          writer.writeByte(0xF0);
+          ++ payload;
+          -- length;
+        }
+        else
+          writer.writeByte(0xF7);
+        writer.writeVarLength(length);
+        writer.write(length, payload);
+        status = 0;
+        return;
+      case Event::Meta:
+        payload = sequence.getPayload(event, length);
+        if ( length == 0 )
+          return;
+        writeMeta(event.position, payload[0], length - 1);
+        writer.write(length - 1, payload + 1);
+        return;
+      default:
+        break;
+    }
+    writer.writeVarLength(event.position - track_time);
+    track_time = event.position;
+    const uint8_t next {static_cast<uint8_t>(event.getType() | channel)};
+    if ( next != status )
+      writer.writeByte(next);
+    status = next;
+    writer.writeByte(event.param1);
+    if ( event.getType() != Event::ProgChange && event.getType() != Event::AfterTouch )
+      writer.writeByte(event.param2);
+  }
+
+  static bool isSongWide(const Event &event)
+  {
+    return event.getType() == Event::Tempo || event.getType() == Event::Meter ||
+           event.getType() == Event::SysEx || event.getType() == Event::Meta;
+  }
+
+public:
+  MIDIWriter(KOutFile &fp) : fp{fp}, writer{fp}, track_time{0}, status{0}, track_start{0}
+  {
+  }
+
+  ~MIDIWriter()
+  {
+    writer.flush();
+    fp.close();
+  }
+
+  // 0 when the whole file went out, -1 when the file would not take it
+  template<class S>
+  int8_t save(const S &sequence)
+  {
+    if ( !fp.isValid() )
+      return -1;
+    const uint32_t header {writer.getPosition()};
+    writer.write(4, reinterpret_cast<const uint8_t *>("MThd"));
+    writer.writeInt(6, 4);
+    writer.writeInt(1, 2);
+    writer.writeInt(0, 2); // track count, filled in at the end
+    writer.writeInt(sequence.getTicks(), 2);
+    uint16_t tracks {0};
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+    {
+      // the tempo track is written even when empty, the others only
+      // once they turn out to have events
+      if ( t == TEMPO_TRACK )
+        beginTrack();
+      const uint8_t channel {sequence.getTrack(t).channel};
+      sequence.forEach(t, [&](const Event &event)
+      {
+        // the metronome's clicks share the tempo track but are no part
+        // of the song
+        if ( t == TEMPO_TRACK && !isSongWide(event) )
+          return;
+        if ( !track_start )
+          beginTrack();
+        writeEvent(sequence, channel, event);
+      });
+      if ( track_start )
+      {
+        endTrack();
+        ++ tracks;
+      }
+    }
+    writer.patchInt(header + 10, tracks, 2);
+    writer.flush();
+    return writer.hasFailed() ? -1 : 0;
+  }
+};
+#endif
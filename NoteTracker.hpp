@@ -0,0 +1,78 @@
+#ifndef NOTETRACKER_HPP
+#define NOTETRACKER_HPP
+#include <stdint.h>
+#include "Event.hpp"
+
+// which notes each of SLOTS senders left sounding, one bit a note, so
+// they can be turned off exactly instead of with all notes off floods
+template<uint8_t SLOTS>
+class NoteTracker
+{
+private:
+  uint32_t notes[SLOTS][4];
+
+public:
+  NoteTracker()
+  {
+    clear();
+  }
+
+  void clear()
+  {
+    for ( uint8_t s{0}; s < SLOTS; ++s )
+      for ( uint8_t i{0}; i < 4; ++i )
+        notes[s][i] = 0;
+  }
+
+  // follows an event on its way out
+  void update(const uint8_t slot, const Event &event)
+  {
+    const uint32_t bit {static_cast<uint32_t>(1) << (event.param1 & 31)};
+    uint32_t &word {notes[slot][(event.param1 >> 5) & 3]};
+    switch ( event.getType() )
+    {
+      case Event::NoteOn:
+        if ( event.param2 )
+          word |= bit;
+        else
+          word &= ~bit;
+        break;
+      case Event::NoteOff:
+        word &= ~bit;
+        break;
+      case Event::Expression:
+        // all sound off, all notes off
+        if ( event.param1 == 0x78 || event.param1 == 0x7B )
+          for ( uint8_t i{0}; i < 4; ++i )
+            notes[slot][i] = 0;
+        break;
+      default:
+        break;
+    }
+  }
+
+  bool isSounding(const uint8_t slot) const
+  {
+    return notes[slot][0] | notes[slot][1] | notes[slot][2] | notes[slot][3];
+  }
+
+  bool isSounding(const uint8_t slot, const uint8_t note) const
+  {
+    return notes[slot][note >> 5 & 3] >> (note & 31) & 1;
+  }
+
+  // calls f with a NoteOff for each note the slot left sounding
+  template<class F>
+  void release(const uint8_t slot, F f)
+  {
+    for ( uint8_t i{0}; i < 4; ++i )
+    {
+      uint32_t word {notes[slot][i]};
+      notes[slot][i] = 0;
+      for ( uint8_t b{0}; word; ++b, word >>= 1 )
+        if ( word & 1 )
+          f(Event{0, Event::NoteOff, 0, static_cast<uint8_t>(i * 32 + b), 0});
+    }
+  }
+};
+#endif
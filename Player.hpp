@@ -4,10 +4,13 @@
 #include "Sequence.hpp"
 #include "MIDIPort.hpp"
 #include "Recorder.hpp"
+#include "NoteTracker.hpp"
 
-class Player
+template<class S>
+class BasicPlayer
 {
 private:
+  static const uint8_t TRACKS = S::TRACKS;
   uint32_t position;
   uint16_t measure;
   uint8_t beat;
@@ -16,15 +19,72 @@ private:
   uint8_t meter_d;
   uint32_t tempo;
   uint32_t delay;
-  Sequence &sequence;
+  S *sequence;
+  S *queued;  // taken over at the next measure
   MIDIPort &midi_port;
-  Recorder &recorder;
+  BasicRecorder<S> &recorder;
   bool playing;
   bool visuals_changed;
+  NoteTracker<TRACKS> notes;
+
+  void send(const uint8_t track, const Event &event)
+  {
+    notes.update(track, event);
+    midi_port.send(sequence->getTrack(track).channel, event);
+  }
+
+  // turns off whatever the track left sounding
+  void release(const uint8_t track)
+  {
+    const uint8_t channel {sequence->getTrack(track).channel};
+    notes.release(track, [&](const Event &event)
+    {
+      midi_port.send(channel, event);
+    });
+  }
+
+  void releaseAll()
+  {
+    for ( uint8_t i{0}; i < TRACKS; ++i )
+      release(i);
+  }
+
+  bool isActive(const Track &track) const
+  {
+    return track.state == Track::OVERDUBBING || track.state == Track::OFF_TO_OVERDUBBING ||
+           track.state == Track::OVERWRITING || track.state == Track::OFF_TO_OVERWRITING ||
+           track.state == Track::OVERDUBBING_TO_OVERWRITING ||
+           track.state == Track::TURNING_OFF;
+  }
+
+  // moves over ticks getIdleTicks() says have nothing to do
+  void skip(const uint32_t ticks)
+  {
+    for ( uint8_t i{0}; i < TRACKS; ++i )
+    {
+      Track &track {sequence->getTrack(i)};
+      if ( isActive(track) )
+        track.position += ticks;
+    }
+    position += ticks;
+  }
+
+  // the queued sequence takes over from its start, in the tempo and
+  // meter playing until its own events at tick 0 change them
+  void switchToQueued()
+  {
+    releaseAll();
+    sequence = queued;
+    queued = 0;
+    recorder.setSequence(*sequence);
+    returnToZero();
+    setTempo(tempo);
+    setMeter(meter_n, meter_d);
+  }
 
 public:
-  Player(Sequence &s, MIDIPort &p, Recorder &r)
-    : position{0}, sequence{s}, midi_port{p}, recorder{r}, playing{false}
+  BasicPlayer(S &s, MIDIPort &p, BasicRecorder<S> &r)
+    : position{0}, sequence{&s}, queued{0}, midi_port{p}, recorder{r}, playing{false}
   {
     setTempo(500000);
     setMeter(4,4);
@@ -35,7 +95,7 @@ public:
   void setTempo(uint32_t t)
   {
     tempo = t;
-    delay = static_cast<uint32_t>(round(static_cast<double>(tempo) / sequence.getTicks()));
+    delay = static_cast<uint32_t>(round(static_cast<double>(tempo) / sequence->getTicks()));
     visuals_changed = true;
   }
 
@@ -43,7 +103,7 @@ public:
   {
     meter_n = n;
     meter_d = d;
-    ticks_per_beat = 4 * sequence.getTicks() / d;
+    ticks_per_beat = 4 * sequence->getTicks() / d;
     visuals_changed = true;
   }
 
@@ -52,6 +112,18 @@ public:
     return delay;
   }
 
+  const uint32_t getTempo() const
+  {
+    return tempo;
+  }
+
+  // when the next tick is due, so recorded input can be placed between
+  // ticks
+  void setTickTime(const uint32_t time)
+  {
+    recorder.setTickTime(time, tempo);
+  }
+
   const uint16_t getBpm() const
   {
     return round(600e6 / tempo);
@@ -77,6 +149,36 @@ public:
     return beat;
   }
 
+  const uint32_t getPosition() const
+  {
+    return position;
+  }
+
+  S &getSequence()
+  {
+    return *sequence;
+  }
+
+  // plays next from the start of the next measure on. Until then the
+  // current sequence keeps playing and next must be left alone; after it,
+  // the old one is free, so songs can be loaded while another plays and
+  // swapped with no gap. Set it with the tick held off
+  void queue(S &next)
+  {
+    queued = &next;
+  }
+
+  // the current sequence plays on; next is free again
+  void unqueue()
+  {
+    queued = 0;
+  }
+
+  bool isQueued() const
+  {
+    return queued != 0;
+  }
+
   void play()
   {
     returnToZero();
@@ -86,10 +188,11 @@ public:
 
   void stop()
   {
+    midi_port.beginTick();
     playing = false;
     recorder.setIsPlaying(playing);
-    for ( uint8_t c {0}; c < 16; ++c )
-      midi_port.send(c, Event::allNotesOff());
+    releaseAll();
+    midi_port.flush();
   }
 
   bool isPlaying() const
@@ -97,6 +200,12 @@ public:
     return playing;
   }
 
+  // true when queued output will still be going out at the next tick
+  bool isOutputBehind() const
+  {
+    return midi_port.getBacklog() > delay;
+  }
+
   const bool visualsChanged()
   {
     if ( visuals_changed )
@@ -113,42 +222,53 @@ public:
     measure = 0;
     beat = 0;
     for ( uint8_t i{0}; i < TRACKS; ++i )
-      sequence.returnToZero(i);
+      sequence->returnToZero(i);
   }
 
   void seek(uint16_t m)
   {
-    SeekResult result {sequence.seek(m)};
+    SeekResult result {sequence->seek(m)};
     position = result.position;
     for ( uint8_t i{0}; i < TRACKS; ++i )
     {
-      Track &track {sequence.getTrack(i)};
+      Track &track {sequence->getTrack(i)};
       track.position = position;
     }
     measure = m;
     beat = 0;
     setTempo(result.tempo);
     setMeter(result.numerator, result.denominator);
+
+    // bring controllers up to where playback resumes
+    midi_port.beginTick();
+    releaseAll();
+    for ( uint8_t i{1}; i < TRACKS; ++i )
+    {
+      const uint8_t channel {sequence->getTrack(i).channel};
+      sequence->getChase(i).restore([&](const Event &event)
+      {
+        midi_port.send(channel, event);
+      });
+    }
+    midi_port.flush();
   }
 
   bool tick(const bool send_events = true)
   {
     if ( !playing )
       return true;
+    midi_port.beginTick();
     for ( uint8_t i{0}; i < TRACKS; ++i )
     {
-      Track &track {sequence.getTrack(i)};
+      Track &track {sequence->getTrack(i)};
 
-      if ( track.state == Track::OVERDUBBING || track.state == Track::OFF_TO_OVERDUBBING ||
-           track.state == Track::OVERWRITING || track.state == Track::OFF_TO_OVERWRITING ||
-	         track.state == Track::OVERDUBBING_TO_OVERWRITING ||
-	         track.state == Track::TURNING_OFF )
+      if ( isActive(track) )
       {
       	if ( send_events )
       	{
-	  while ( sequence.notUndefined(i) )
+	  while ( sequence->notUndefined(i) )
 	  {
-	      Event &event = sequence.getEvent(i);
+	      Event &event = sequence->getEvent(i);
 	      if ( event.position > track.position )
 		  break;
 	      bool advance_event;
@@ -162,22 +282,32 @@ public:
 		    case Event::Meter:
 			setMeter(event.param0, event.param1);
 			break;
+		    case Event::SysEx:
+			{
+			  uint16_t length;
+			  const uint8_t *data {sequence->getPayload(event, length)};
+			  midi_port.sendSysEx(data, length);
+			}
+			break;
+		    case Event::Meta:
+			break;
 		    default:
-			midi_port.send(track.channel, event);
+			send(i, event);
 		}
 	      }
 
 	      if ( advance_event )
-		sequence.nextEvent(i);
+		sequence->nextEvent(i);
 	  }
       	}
 
 				recorder.handleTick(i);
         track.position ++;
-        if ( track.length && track.position == track.length*sequence.getTicks() )
+        if ( track.length && track.position == track.length*sequence->getTicks() )
         {
             track.position = 0;
-            sequence.returnToZero(i);
+            release(i);
+            sequence->returnToZero(i);
 						recorder.handleLoopEnd(track);
         }
       }
@@ -192,14 +322,75 @@ public:
         beat = 0;
         measure ++;
 	recorder.handleMeasure();
+	// tracks that just turned off
+	for ( uint8_t i{0}; i < TRACKS; ++i )
+	  if ( !isActive(sequence->getTrack(i)) )
+	    release(i);
+	if ( queued )
+	  switchToQueued();
      }
       visuals_changed = true;
     }
+    midi_port.flush();
 
+    return hasEvents();
+  }
+
+  bool hasEvents()
+  {
     for ( uint8_t i{1}; i < TRACKS; ++i )
-      if ( sequence.notUndefined(i) )
+      if ( sequence->notUndefined(i) )
         return true;
     return false;
   }
+
+  // number of upcoming ticks that would neither send an event, wrap a
+  // loop nor cross a beat, so they can be skipped without calling tick()
+  uint32_t getIdleTicks()
+  {
+    if ( !playing || !recorder.isIdle() )
+      return 0;
+    uint32_t idle {ticks_per_beat - 1 - position % ticks_per_beat};
+    for ( uint8_t i{0}; i < TRACKS && idle > 0; ++i )
+    {
+      const Track &track {sequence->getTrack(i)};
+      if ( !isActive(track) )
+        continue;
+      const int32_t next {sequence->getNextPosition(i)};
+      if ( next <= track.position )
+        return 0;
+      if ( static_cast<uint32_t>(next - track.position) < idle )
+        idle = next - track.position;
+      if ( track.length )
+      {
+        const int32_t end {track.length*sequence->getTicks() - 1 - track.position};
+        if ( end >= 0 && static_cast<uint32_t>(end) < idle )
+          idle = end;
+      }
+    }
+    return idle;
+  }
+
+  // plays up to target, only calling tick() where there is work to do.
+  // Stops early on switching to a queued sequence, as its position
+  // starts over from 0
+  bool advanceTo(const uint32_t target)
+  {
+    if ( !playing )
+      return true;
+    const S *const current {sequence};
+    while ( position < target && sequence == current )
+    {
+      uint32_t idle {getIdleTicks()};
+      if ( idle > target - position )
+        idle = target - position;
+      skip(idle);
+      if ( position < target )
+        tick();
+    }
+    return hasEvents();
+  }
 };
+
+typedef BasicPlayer<Sequence> Player;
 #endif
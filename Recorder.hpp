@@ -2,11 +2,21 @@
 #define RECORDER_HPP
 #include "Sequence.hpp"
 #include "MIDIPort.hpp"
+#include "SPSCQueue.hpp"
+#include "NoteTracker.hpp"
 
-class Recorder
+struct TimedEvent
+{
+  uint32_t time;
+  Event event;
+};
+
+template<class S>
+class BasicRecorder
 {
 private:
-  Sequence &sequence;
+  static const uint8_t TRACKS = S::TRACKS;
+  S *sequence;
   MIDIPort &midi_port;
   MIDIPort &metronome_port;
   uint8_t quantization;
@@ -15,42 +25,108 @@ private:
   bool is_playing;
   bool is_recording;
   bool metronome;
-  static const uint8_t MAX_PENDING = 8;
-  Event pending[MAX_PENDING];
-  uint8_t pending_count = 0;
+  // filled by the MIDI input thread, emptied on the player's
+  SPSCQueue<TimedEvent, 64> input;
+  static const int32_t SUBTICKS = 256;
+  uint32_t tick_time;
+  uint32_t tick_tempo;
+  uint32_t input_latency;
+  NoteTracker<1> metronome_notes;
+
+  void sendMetronome(const Event &event)
+  {
+    metronome_notes.update(0, event);
+    metronome_port.send(sequence->getTrack(metronome_track).channel, event);
+  }
+
+  void releaseMetronome()
+  {
+    metronome_notes.release(0, [this](const Event &event)
+    {
+      metronome_port.send(sequence->getTrack(metronome_track).channel, event);
+    });
+  }
+
+  // position of a timed event in 1/SUBTICKS of a tick, measured back
+  // from the current tick with the tempo it was played at
+  int32_t getSubtickPosition(const Track &track, const uint32_t time) const
+  {
+    int32_t position {track.position * SUBTICKS};
+    if ( time == 0 || tick_tempo == 0 )
+      return position;
+    const int32_t offset {static_cast<int32_t>(time - input_latency - tick_time)};
+    position += static_cast<int64_t>(offset) * sequence->getTicks() * SUBTICKS / tick_tempo;
+    // played just before the loop started over
+    if ( position < 0 && track.length )
+      position += track.length * sequence->getTicks() * SUBTICKS;
+    return position;
+  }
+
+  void record(const Track &track, const TimedEvent &timed)
+  {
+    // a full sequence records nothing more
+    if ( sequence->getUsage() >= 100 )
+      return;
+    Event event {timed.event};
+    const int32_t subtick {getSubtickPosition(track, timed.time)};
+    event.position = subtick >= 0 ? (subtick + SUBTICKS / 2) / SUBTICKS : -1;
+    if ( event.getType() == Event::NoteOn && subtick >= 0 )
+      event.position = quantize(subtick, quantization * SUBTICKS) / SUBTICKS;
+    if ( event.position >= track.length*sequence->getTicks() )
+      event.position -= track.length*sequence->getTicks();
+    if ( event.getType() == Event::NoteOn )
+    {
+      if ( event.position >= 0 )
+      {
+        InsertResult<Event> insert_result = sequence->addEvent(record_track, event);
+        if ( insert_result.forward )
+          insert_result.new_node.setNew(true);
+      }
+    }
+    else if ( event.getType() == Event::NoteOff )
+    {
+      if ( event.position >= 0 )
+        sequence->addEvent(record_track, event);
+    }
+  }
+
 public:
-  Recorder(Sequence &s, MIDIPort &mp, MIDIPort &metp)
+  BasicRecorder(S &s, MIDIPort &mp, MIDIPort &metp)
     : is_playing{false}, is_recording{true}, metronome{true}, quantization{6}, record_track{1},
-      sequence{s}, midi_port{mp}, metronome_port{metp}
+      sequence{&s}, midi_port{mp}, metronome_port{metp}, tick_time{0}, tick_tempo{0},
+      input_latency{0}
   {
   }
 
   void initMetronome()
   {
     // create metronome track
-    const int32_t ticks {sequence.getTicks()};
-    sequence.setTrackLength(metronome_track, 4);
-    sequence.getTrack(metronome_track).channel = 0;
-    sequence.addEvent(metronome_track, Event{0, Event::NoteOn, 0, 60, 110});
-    sequence.addEvent(metronome_track, Event{ticks/8, Event::NoteOff, 0, 60, 0});
+    const int32_t ticks {sequence->getTicks()};
+    sequence->setTrackLength(metronome_track, 4);
+    sequence->getTrack(metronome_track).channel = 0;
+    sequence->addEvent(metronome_track, Event{0, Event::NoteOn, 0, 60, 110});
+    sequence->addEvent(metronome_track, Event{ticks/8, Event::NoteOff, 0, 60, 0});
     for ( uint8_t i = 1; i < 4; i ++ )
     {
-      sequence.addEvent(metronome_track, Event{ticks*i, Event::NoteOn, 0, 60, 80});
-      sequence.addEvent(metronome_track, Event{ticks*i + ticks/8, Event::NoteOff, 0, 60, 0});
+      sequence->addEvent(metronome_track, Event{ticks*i, Event::NoteOn, 0, 60, 80});
+      sequence->addEvent(metronome_track, Event{ticks*i + ticks/8, Event::NoteOff, 0, 60, 0});
     }
     // default remaining tracks to 2 bar lengths
     for ( uint8_t i{1}; i < TRACKS; ++i )
-      sequence.setTrackLength(i, 8);
+      sequence->setTrackLength(i, 8);
+  }
+
+  // follows the player onto the sequence it switched to
+  void setSequence(S &s)
+  {
+    sequence = &s;
   }
 
   void setMetronome(bool m)
   {
     metronome = m;
     if ( !metronome )
-    {
-      const Track &track {sequence.getTrack(metronome_track)};
-      metronome_port.send(track.channel, Event::allNotesOff());
-    }
+      releaseMetronome();
   }
 
   bool isMetronomeOn() const
@@ -62,10 +138,7 @@ public:
   {
     is_playing = playing;
     if ( !is_playing )
-    {
-      const Track &track {sequence.getTrack(metronome_track)};
-      metronome_port.send(track.channel, Event::allNotesOff());
-    }
+      releaseMetronome();
   }
 
   void setIsRecording(const bool recording)
@@ -85,13 +158,13 @@ public:
 
   void toggleTrack(const uint8_t t, bool overwrite)
   {
-    Track &track {sequence.getTrack(t)};
-    const Track &metronome {sequence.getTrack(metronome_track)};
+    Track &track {sequence->getTrack(t)};
+    const Track &metronome {sequence->getTrack(metronome_track)};
     switch ( track.state )
     {
       case Track::OFF:
-	sequence.returnToZero(t);
-	track.position = metronome.position - metronome.length*sequence.getTicks();
+	sequence->returnToZero(t);
+	track.position = metronome.position - metronome.length*sequence->getTicks();
 	if ( overwrite )
 	  track.state = Track::OFF_TO_OVERWRITING;
 	else
@@ -124,6 +197,11 @@ public:
   }
 
   int32_t quantize(const int32_t position) const
+  {
+    return quantize(position, quantization);
+  }
+
+  int32_t quantize(const int32_t position, const int32_t quantization) const
   {
     int32_t less {position / quantization * quantization};
     int32_t more {less + quantization};
@@ -133,7 +211,7 @@ public:
       return more;
   }
 
-  bool isRecordState(const uint8_t track_index, const Track &track)
+  bool isRecordState(const uint8_t track_index, const Track &track) const
   {
     return track_index == record_track && is_playing && is_recording &&
 	 (track.state == Track::OVERDUBBING || track.state == Track::OFF_TO_OVERDUBBING || 
@@ -141,61 +219,74 @@ public:
 	  track.state == Track::TURNING_OFF);
   }
 
-  void receiveEvent(Event event)
+  // when the tick about to be handled is due, on the clock that stamps
+  // received events
+  void setTickTime(const uint32_t time, const uint32_t tempo)
+  {
+    tick_time = time;
+    tick_tempo = tempo;
+  }
+
+  // how long input takes to reach receiveEvent, taken off its time
+  void setInputLatency(const uint32_t latency)
+  {
+    input_latency = latency;
+  }
+
+  uint32_t getInputLatency() const
+  {
+    return input_latency;
+  }
+
+  // false while received input waits for handleTick() to record it.
+  // Being armed alone keeps no tick busy: input stamped with its time is
+  // placed where it was played whichever tick takes it in
+  bool isIdle() const
   {
-    const Track &track {sequence.getTrack(record_track)};
+    return input.isEmpty();
+  }
+
+  // input dropped because the player thread fell behind
+  uint32_t getInputOverflows() const
+  {
+    return input.getOverflows();
+  }
+
+  // may be called from the MIDI input thread; time is when it arrived,
+  // 0 stamps it with the tick that handles it
+  void receiveEvent(Event event, const uint32_t time = 0)
+  {
+    const Track &track {sequence->getTrack(record_track)};
     midi_port.send(track.channel, event);
     if ( isRecordState(record_track, track) )
-    {
-      assert(pending_count < MAX_PENDING);
-      pending[pending_count++] = event;
-    }
+      input.push(TimedEvent{time, event});
   }
 
   void handleTick(const uint8_t track_index)
   {
-    const Track &track {sequence.getTrack(record_track)};
+    const Track &track {sequence->getTrack(record_track)};
     if ( isRecordState(track_index, track) )
     {
       // insert all pending recorded events
-      for ( uint8_t i = 0; i < pending_count; i ++ )
+      input.drain([&](const TimedEvent &timed)
       {
-	Event event = pending[i];
-        event.position = track.position;
-	if ( event.getType() == Event::NoteOn )
-	{
-	  event.position = quantize(event.position);
-	  if ( event.position >= track.length*sequence.getTicks() )
-	    event.position -= track.length*sequence.getTicks();
-	  if ( event.position >= 0 )
-	  {
-	    InsertResult<Event> insert_result = sequence.addEvent(record_track, event);
-	    if ( insert_result.forward )
-	      insert_result.new_node.setNew(true);
-	  }
-	}
-	else if ( event.getType() == Event::NoteOff )
-	{
-	  if ( event.position >= 0 )
-	    InsertResult<Event> insert_result = sequence.addEvent(record_track, event);
-	  //if ( insert_result.forward )
-	  //  insert_result.new_node.setNew(true);
-	}
-      }
-      pending_count = 0;
+        record(track, timed);
+      });
     }
   }
 
   bool handlePlayEvent(const uint8_t track_index, Event &event, bool &advance_event)
   {
-    const Track &track {sequence.getTrack(track_index)};
+    const Track &track {sequence->getTrack(track_index)};
     advance_event = true;
     if ( track_index == 0 )
     {
-      if ( event.getType() == Event::Tempo || event.getType() == Event::Meter )
+      // the player's own; the rest on this track is the metronome
+      if ( event.getType() == Event::Tempo || event.getType() == Event::Meter ||
+           event.getType() == Event::SysEx || event.getType() == Event::Meta )
         return false;
       if ( metronome )
-        metronome_port.send(track.channel, event);
+        sendMetronome(event);
       return true;
     }
     else if ( is_recording && track_index == record_track )
@@ -214,7 +305,10 @@ public:
 	  event.setNew(false);
 	else
 	{
-          sequence.removeEvent(record_track);
+          // everything old from here up to the playhead goes at once;
+          // the pointer lands on what is left
+          sequence->eraseAhead(record_track, track.position + 1,
+                              [](const Event &e) { return e.isNew(); });
           advance_event = false;
 	}
         return true;
@@ -228,7 +322,7 @@ public:
     // flip tracks on or off
     for ( uint8_t i{1}; i < TRACKS; ++i )
     {
-	Track &track {sequence.getTrack(i)};
+	Track &track {sequence->getTrack(i)};
 	switch ( track.state )
 	{
 	  case Track::OFF_TO_OVERDUBBING:
@@ -268,4 +362,6 @@ public:
     }
   }
 };
+
+typedef BasicRecorder<Sequence> Recorder;
 #endif
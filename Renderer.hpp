@@ -0,0 +1,102 @@
+#ifndef RENDERER_HPP
+#define RENDERER_HPP
+#include <stdint.h>
+#include "Event.hpp"
+#include "MIDIPort.hpp"
+#include "Clock.hpp"
+#include "Sequence.hpp"
+#include "Recorder.hpp"
+#include "Player.hpp"
+
+// a message as it would have gone out: when, on which channel
+struct RenderedEvent
+{
+  uint32_t time;
+  uint8_t channel;
+  Event event;
+};
+
+// time that only moves when waited on, so a Clock never sleeps
+class OfflineTiming
+{
+private:
+  uint32_t microseconds;
+
+public:
+  OfflineTiming() : microseconds{0}
+  {
+  }
+
+  uint32_t getMicroseconds() const
+  {
+    return microseconds;
+  }
+
+  void delay(const uint32_t us)
+  {
+    microseconds += us;
+  }
+};
+
+// plays a sequence with no real clock and hands every message, stamped
+// with the time it is due, to sink as fast as the CPU allows. Ticks are
+// timed like play does, so tempo changes apply from the tick they are on
+template<class S, class Sink>
+class BasicRenderer : public MIDIPort
+{
+private:
+  S &sequence;
+  Sink &sink;
+  OfflineTiming timing;
+  Clock<OfflineTiming> clock;
+  BasicRecorder<S> recorder;
+  BasicPlayer<S> player;
+  uint32_t count;
+
+public:
+  BasicRenderer(S &s, Sink &k)
+    : sequence{s}, sink{k}, clock{timing}, recorder{s, *this, *this}, player{s, *this, recorder}, count{0}
+  {
+    recorder.setMetronome(false);
+    recorder.setIsRecording(false);
+  }
+
+  void send(const uint8_t channel, const Event &event)
+  {
+    sink(RenderedEvent{timing.getMicroseconds(), channel, event});
+    ++ count;
+  }
+
+  // plays from the top until no track has events left, or for at most
+  // max_ticks when tracks loop; the notes still sounding are released
+  // at the end. Returns the number of messages
+  uint32_t render(const uint32_t max_ticks = UINT32_MAX)
+  {
+    count = 0;
+    timing = OfflineTiming{};
+    clock.reset();
+    // as a fresh player, not in the tempo the last render ended on
+    player.setTempo(500000);
+    player.setMeter(4, 4);
+    player.play();
+    uint32_t ticks {1};
+    while ( player.advanceTo(player.getPosition() + ticks) &&
+            player.getPosition() < max_ticks )
+    {
+      ticks = player.getIdleTicks() + 1;
+      if ( ticks > max_ticks - player.getPosition() )
+        ticks = max_ticks - player.getPosition();
+      clock.advance(ticks, player.getTempo(), sequence.getTicks());
+      clock.wait();
+    }
+    player.stop();
+    return count;
+  }
+
+  // time of the last tick played
+  uint32_t getLength() const
+  {
+    return timing.getMicroseconds();
+  }
+};
+#endif
@@ -0,0 +1,65 @@
+#ifndef SPSCQUEUE_HPP
+#define SPSCQUEUE_HPP
+#include <stdint.h>
+#include <atomic>
+
+// bounded wait-free queue for one producer thread (or interrupt) and one
+// consumer; only loads and stores are used so it needs no lock or
+// libatomic on small cores. Holds SIZE-1 items
+template<class T, uint16_t SIZE>
+class SPSCQueue
+{
+private:
+  T items[SIZE];
+  std::atomic<uint16_t> head; // written by the consumer
+  std::atomic<uint16_t> tail; // written by the producer
+  std::atomic<uint32_t> overflows; // written by the producer
+
+public:
+  SPSCQueue() : head{0}, tail{0}, overflows{0}
+  {
+  }
+
+  // producer side; counts and drops the item when the queue is full
+  bool push(const T &item)
+  {
+    const uint16_t t {tail.load(std::memory_order_relaxed)};
+    const uint16_t next = (t + 1) % SIZE;
+    if ( next == head.load(std::memory_order_acquire) )
+    {
+      overflows.store(overflows.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      return false;
+    }
+    items[t] = item;
+    tail.store(next, std::memory_order_release);
+    return true;
+  }
+
+  // consumer side; hands every queued item to f in arrival order
+  template<class F>
+  uint16_t drain(F f)
+  {
+    uint16_t h {head.load(std::memory_order_relaxed)};
+    const uint16_t t {tail.load(std::memory_order_acquire)};
+    uint16_t count {0};
+    while ( h != t )
+    {
+      f(items[h]);
+      h = (h + 1) % SIZE;
+      head.store(h, std::memory_order_release);
+      count ++;
+    }
+    return count;
+  }
+
+  bool isEmpty() const
+  {
+    return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+  }
+
+  uint32_t getOverflows() const
+  {
+    return overflows.load(std::memory_order_relaxed);
+  }
+};
+#endif
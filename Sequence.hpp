@@ -1,11 +1,18 @@
 #ifndef SEQUENCE_HPP
 #define SEQUENCE_HPP
 #include "Buffer.hpp"
+#include "ChunkBuffer.hpp"
 #include "Event.hpp"
+#include "TempoMap.hpp"
+#include "Chase.hpp"
+#include "Arena.hpp"
 
-static const int TRACKS = 17;
-static const int SIZE = 8192;
+static const int CHECKPOINTS = 64;
 static const int TEMPO_TRACK = 0;
+static const int TEMPO_SEGMENTS = 64;
+static const int CHASE_SNAPSHOTS = 32;
+static const int CHASE_MEASURES = 4;
+static const int ARENA_SIZE = 4096;
 
 struct SeekResult
 {
@@ -36,44 +43,41 @@ struct Track
   }
 };
 
-class Sequence
+// INDEX is the link type of the event buffer, CAPACITY the number of
+// events it holds and TRACK_COUNT the tempo track plus one per channel.
+// STORAGE is the event store: Buffer links every event, ChunkBuffer keeps
+// them in blocks that scan faster. Memory is about the same: a Buffer
+// node is the event and two links, a block entry the event and a copy of
+// its position for the searches
+template<class INDEX, uint32_t CAPACITY, uint8_t TRACK_COUNT,
+         template<class, uint32_t, uint8_t, uint8_t, class> class STORAGE = Buffer>
+class BasicSequence
 {
+public:
+  static const uint8_t TRACKS = TRACK_COUNT;
+  static const uint32_t SIZE = CAPACITY;
+  typedef STORAGE<Event, SIZE, TRACKS, CHECKPOINTS, INDEX> Storage;
+
 private:
-  Buffer<Event, SIZE, TRACKS> buffer;
+  Storage buffer;
   Track track[TRACKS];
   uint16_t ticks;
+  TempoMap<TEMPO_SEGMENTS> tempo_map;
+  bool tempo_changed;
+  ChaseCache<TRACKS, CHASE_SNAPSHOTS, CHASE_MEASURES> chase_cache;
+  bool chase_changed;
+  ChaseState chase[TRACKS];
+  Arena<ARENA_SIZE> arena;
 
-  const SeekResult getPosition(const uint16_t measure)
+  void trackChanged(const uint8_t t)
   {
-    buffer.returnToZero(TEMPO_TRACK);
-    uint16_t m {0};
-    SeekResult result;
-    result.position = 0;
-    result.numerator = 4;
-    result.denominator = 4;
-    result.tempo = 500000;
-    while ( buffer.notUndefined(TEMPO_TRACK) )
-    {
-      const Event &event {buffer.get(TEMPO_TRACK)};
-      if ( event.getType() == Event::Meter )
-      {
-      	result.position = event.position;
-      	m += result.position * result.denominator / (result.numerator * ticks * 4);
-      	result.numerator = event.param0;
-      	result.denominator = event.param1;
-      	if ( m >= measure )
-      	  break;
-      }
-      else if ( event.getType() == Event::Tempo )
-      	result.tempo = event.getTempo();
-      buffer.next(TEMPO_TRACK);
-    }
-    result.position += (measure - m)*result.numerator*ticks*4/result.denominator;
-    return result;
+    if ( t == TEMPO_TRACK )
+      tempo_changed = true;
+    chase_changed = true;
   }
 
 public:
-  Sequence()
+  BasicSequence()
   {
     clear();
     track[0].channel = 0;
@@ -84,7 +88,10 @@ public:
   void clear()
   {
     buffer.clear();
+    arena.clear();
     ticks = 24;
+    tempo_changed = true;
+    chase_changed = true;
   }
 
   Track &getTrack(const uint8_t t)
@@ -92,6 +99,11 @@ public:
     return track[t];
   }
 
+  const Track &getTrack(const uint8_t t) const
+  {
+    return track[t];
+  }
+
   void setTrackLength(const uint8_t t, const uint8_t l)
   {
     track[t].length = l;
@@ -105,6 +117,20 @@ public:
   void setTicks(uint16_t t)
   {
     ticks = t;
+    tempo_changed = true;
+    chase_changed = true;
+  }
+
+  // rebuilt on demand after the tempo track changes
+  const TempoMap<TEMPO_SEGMENTS> &getTempoMap()
+  {
+    if ( tempo_changed )
+    {
+      tempo_map.clear(ticks);
+      buffer.forEach(TEMPO_TRACK, [this](const Event &event) { tempo_map.add(event); });
+      tempo_changed = false;
+    }
+    return tempo_map;
   }
 
   void returnToZero(const uint8_t t)
@@ -115,20 +141,46 @@ public:
 
   const SeekResult seek(const uint16_t measure)
   {
-    SeekResult result {getPosition(measure)};
+    const TempoMap<TEMPO_SEGMENTS> &map {getTempoMap()};
+    SeekResult result;
+    result.position = map.getMeasurePosition(measure);
+    const TempoSegment &segment {map.getSegment(result.position)};
+    result.tempo = segment.tempo;
+    result.numerator = segment.numerator;
+    result.denominator = segment.denominator;
+    if ( chase_changed )
+    {
+      chase_cache.build(buffer, map);
+      chase_changed = false;
+    }
+    // start from the snapshot before the measure and chase up to it
+    const uint8_t snapshot {chase_cache.getSnapshot(measure)};
+    const int32_t from {chase_cache.getPosition(snapshot)};
     for ( uint8_t t {0}; t < TRACKS; ++t )
     {
-      buffer.seek(t, Event{result.position, Event::NoteOff, 0, 0, 0});
+      chase[t] = chase_cache.get(snapshot, t);
+      buffer.seek(t, Event{from, Event::NoteOff, 0, 0, 0});
       if ( buffer.notUndefined(t) )
       {
 	const Event &event {buffer.get(t)};
-	if ( event.position < result.position )
+	if ( event.position < from )
 	  buffer.setUndefined(t);
       }
+      while ( buffer.notUndefined(t) && buffer.get(t).position < result.position )
+      {
+        chase[t].apply(buffer.get(t));
+        buffer.next(t);
+      }
     }
     return result;
   }
 
+  // controller state of a track at the last seek
+  const ChaseState &getChase(const uint8_t t) const
+  {
+    return chase[t];
+  }
+
   Event& getEvent(uint8_t track)
   {
     return buffer.get(track);
@@ -139,32 +191,155 @@ public:
     return buffer.notUndefined(track);
   }
 
+  // position of the next event to play, INT32_MAX when the track is done
+  int32_t getNextPosition(const uint8_t track)
+  {
+    return buffer.notUndefined(track) ? buffer.get(track).position : INT32_MAX;
+  }
+
   void nextEvent(const uint8_t track)
   {
     assert(buffer.notUndefined(track));
     buffer.next(track);
   }
 
+  // points a track that has played all it held at its first event from
+  // position on, once more were appended behind the played ones
+  void resume(const uint8_t track, const int32_t position)
+  {
+    if ( buffer.notUndefined(track) )
+      return;
+    buffer.seek(track, Event{position, Event::NoteOff, 0, 0, 0});
+    if ( buffer.notUndefined(track) && buffer.get(track).position < position )
+      buffer.setUndefined(track);
+  }
+
   InsertResult<Event> addEvent(const uint8_t track, const Event &event)
   {
+    trackChanged(track);
     return buffer.insert(track, event);
   }
 
+  InsertResult<Event> appendEvent(const uint8_t track, const Event &event)
+  {
+    trackChanged(track);
+    return buffer.append(track, event);
+  }
+
+  // appends event with room for a payload of length bytes, which the
+  // caller fills in; 0, and no event, when the arena is full. Payloads on
+  // the same tick stay in the order they were appended
+  uint8_t *appendPayload(const uint8_t track, const Event &event, const uint16_t length)
+  {
+    const uint32_t offset {arena.allocate(length)};
+    if ( offset == Arena<ARENA_SIZE>::UNDEFINED )
+      return 0;
+    Event stored {event};
+    stored.setOffset(offset);
+    trackChanged(track);
+    buffer.appendAfter(track, stored);
+    return arena.getPayload(offset);
+  }
+
+  // the payload of a SysEx or Meta event
+  const uint8_t *getPayload(const Event &event, uint16_t &length) const
+  {
+    length = arena.getLength(event.getOffset());
+    return arena.getPayload(event.getOffset());
+  }
+
+  Arena<ARENA_SIZE> &getArena()
+  {
+    return arena;
+  }
+
+  const Arena<ARENA_SIZE> &getArena() const
+  {
+    return arena;
+  }
+
   void removeEvent(const uint8_t track)
   {
+    trackChanged(track);
     buffer.remove(track);
   }
 
+  // bulk load of n events already in order onto the end of a track,
+  // read(Event &) filling in each; see Buffer::fill
+  template<class F>
+  bool fill(const uint8_t track, const INDEX n, F read)
+  {
+    trackChanged(track);
+    return buffer.fill(track, n, read);
+  }
+
+  // removes the track's events from from up to before to in one pass,
+  // leaving those keep accepts
+  template<class F>
+  INDEX eraseRange(const uint8_t track, const int32_t from, const int32_t to, F keep)
+  {
+    trackChanged(track);
+    return buffer.eraseRange(track, Event{from, Event::NoteOff, 0, 0, 0},
+                             Event{to, Event::NoteOff, 0, 0, 0}, keep);
+  }
+
+  INDEX eraseRange(const uint8_t track, const int32_t from, const int32_t to)
+  {
+    return eraseRange(track, from, to, [](const Event &) { return false; });
+  }
+
+  // removes events from the track's pointer up to before to, leaving
+  // those keep accepts and what the pointer has passed
+  template<class F>
+  INDEX eraseAhead(const uint8_t track, const int32_t to, F keep)
+  {
+    trackChanged(track);
+    return buffer.eraseAhead(track, Event{to, Event::NoteOff, 0, 0, 0}, keep);
+  }
+
+  // visits all of a track's events in order, leaving its pointer alone
+  template<class F>
+  void forEach(const uint8_t track, F f) const
+  {
+    buffer.forEach(track, f);
+  }
+
+  // visits the track's events from from up to before to
+  template<class F>
+  void forEachInRange(const uint8_t track, const int32_t from, const int32_t to, F f)
+  {
+    buffer.forEachInRange(track, Event{from, Event::NoteOff, 0, 0, 0},
+                          Event{to, Event::NoteOff, 0, 0, 0}, f);
+  }
+
+  // defragments the event storage a slice at a time, see Buffer::compact
+  bool compact(const uint16_t budget)
+  {
+    return buffer.compact(budget);
+  }
+
+  // how full the storage is, in percent; at 100 nothing more can be
+  // added
   uint8_t getUsage() const
   {
-    return (buffer.getCount() * 100) / SIZE;
+    return buffer.getUsage();
   }
 
   #ifdef CATCH_CONFIG_MAIN
-  Buffer<Event,SIZE,TRACKS> &getBuffer()
+  Storage &getBuffer()
   {
     return buffer;
   }
   #endif
 };
+
+template<class INDEX, uint32_t CAPACITY, uint8_t TRACK_COUNT,
+         template<class, uint32_t, uint8_t, uint8_t, class> class STORAGE>
+const uint8_t BasicSequence<INDEX, CAPACITY, TRACK_COUNT, STORAGE>::TRACKS;
+template<class INDEX, uint32_t CAPACITY, uint8_t TRACK_COUNT,
+         template<class, uint32_t, uint8_t, uint8_t, class> class STORAGE>
+const uint32_t BasicSequence<INDEX, CAPACITY, TRACK_COUNT, STORAGE>::SIZE;
+
+// the board's footprint: 8192 events of 12 bytes, a track per channel
+typedef BasicSequence<int16_t, 8192, 17> Sequence;
 #endif
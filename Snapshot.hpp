@@ -0,0 +1,279 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+#include <stdint.h>
+#include "Sequence.hpp"
+#include "File.hpp"
+#include "FileReader.hpp"
+#include "FileWriter.hpp"
+
+// running Adler-32, the modulo put off for as long as the sums can't
+// overflow
+class Adler32
+{
+private:
+  uint32_t a;
+  uint32_t b;
+  uint16_t pending;
+
+public:
+  Adler32() : a{1}, b{0}, pending{0}
+  {
+  }
+
+  void update(const uint8_t *data, uint32_t length)
+  {
+    while ( length -- )
+    {
+      a += *data++;
+      b += a;
+      if ( ++pending == 5552 )
+      {
+        a %= 65521;
+        b %= 65521;
+        pending = 0;
+      }
+    }
+  }
+
+  uint32_t get() const
+  {
+    return ((b % 65521) << 16) | (a % 65521);
+  }
+};
+
+template<class S>
+class SnapshotLoader;
+
+// the sequence as it sits in memory, for loading a session without
+// parsing a MIDI file: a header, ticks, the settings of every track, the
+// payload arena and then each track's events as raw Event bytes in
+// order, so loading is a copy into the buffer's nodes and one pass over
+// their links. An Adler-32 of everything before it closes the file. The
+// events are not converted, so a snapshot only loads where Event has the
+// same size and byte order as where it was saved
+class Snapshot
+{
+public:
+  static const uint16_t VERSION = 2;
+
+  // errors returned by load and save
+  enum Error : int8_t
+  {
+    FILE_ERROR = -1,
+    FORMAT_ERROR = -2,  // not a snapshot, or not this layout
+    TOO_LARGE = -3,     // more events than the buffer holds
+    CORRUPT = -4,       // checksum or event order wrong
+  };
+
+private:
+  template<class S>
+  friend class SnapshotLoader;
+
+  static const uint16_t ORDER_MARK = 0x0102;
+
+  template<class W>
+  static void put(W &writer, Adler32 &sum, const uint32_t length, const void *data)
+  {
+    sum.update(static_cast<const uint8_t *>(data), length);
+    writer.write(length, static_cast<const uint8_t *>(data));
+  }
+
+  template<class R>
+  static bool get(R &reader, Adler32 &sum, const uint32_t length, void *data)
+  {
+    if ( reader.read(length, static_cast<uint8_t *>(data)) != length )
+      return false;
+    sum.update(static_cast<const uint8_t *>(data), length);
+    return true;
+  }
+
+  struct Header
+  {
+    char magic[4];
+    uint16_t version;
+    uint16_t byte_order;
+    uint8_t event_size;
+    uint8_t tracks;
+    uint16_t ticks;
+  };
+
+  struct TrackHeader
+  {
+    uint32_t count;
+    uint8_t channel;
+    uint8_t length;
+    uint8_t state;
+    uint8_t unused;
+  };
+
+public:
+  // 0 when the whole snapshot went out, FILE_ERROR otherwise
+  template<class S>
+  static int8_t save(KOutFile &file, const S &sequence)
+  {
+    if ( !file.isValid() )
+      return FILE_ERROR;
+    FileWriter<> writer{file};
+    Adler32 sum;
+    const Header header {{'K', 'R', 'S', 'N'}, VERSION, ORDER_MARK,
+                         sizeof(Event), S::TRACKS, sequence.getTicks()};
+    put(writer, sum, sizeof(header), &header);
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+    {
+      const Track &track {sequence.getTrack(t)};
+      TrackHeader entry {0, track.channel, track.length,
+                         static_cast<uint8_t>(track.state), 0};
+      sequence.forEach(t, [&](const Event &) { ++ entry.count; });
+      put(writer, sum, sizeof(entry), &entry);
+    }
+    const uint32_t arena {sequence.getArena().getUsed()};
+    put(writer, sum, sizeof(arena), &arena);
+    put(writer, sum, arena, sequence.getArena().getData());
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+      sequence.forEach(t, [&](const Event &event)
+      {
+        put(writer, sum, sizeof(Event), &event);
+      });
+    const uint32_t checksum {sum.get()};
+    writer.write(sizeof(checksum), reinterpret_cast<const uint8_t *>(&checksum));
+    writer.flush();
+    const bool failed {writer.hasFailed()};
+    file.close();
+    return failed ? FILE_ERROR : 0;
+  }
+
+  // replaces the sequence with the snapshot's. On any error the sequence
+  // is left cleared, never half loaded
+  template<class S>
+  static int8_t load(KFile &file, S &sequence);
+};
+
+// loads a snapshot a slice of events at a time, so a song can be loaded
+// while another plays: begin() takes the header, track settings and
+// payloads, loadSlice() the events
+template<class S>
+class SnapshotLoader
+{
+private:
+  KFile &file;
+  FileReader<> reader;
+  Adler32 sum;
+  Snapshot::Header header;
+  Snapshot::TrackHeader entries[S::TRACKS];
+  uint8_t track;
+  uint32_t done;  // of the track's events
+  int32_t last;
+  bool ordered;
+
+  int8_t fail(S &sequence, const int8_t error)
+  {
+    sequence.clear();
+    return error;
+  }
+
+public:
+  SnapshotLoader(KFile &file)
+    : file{file}, reader{file}, track{0}, done{0}, last{INT32_MIN}, ordered{true}
+  {
+  }
+
+  // clears the sequence for loadSlice(); 1 when it can go on, an error
+  // otherwise
+  int8_t begin(S &sequence)
+  {
+    if ( !file.isValid() )
+      return Snapshot::FILE_ERROR;
+    sequence.clear();
+    if ( !Snapshot::get(reader, sum, sizeof(header), &header) )
+      return Snapshot::FORMAT_ERROR;
+    if ( header.magic[0] != 'K' || header.magic[1] != 'R' ||
+         header.magic[2] != 'S' || header.magic[3] != 'N' ||
+         header.version != Snapshot::VERSION || header.byte_order != Snapshot::ORDER_MARK ||
+         header.event_size != sizeof(Event) || header.tracks != S::TRACKS )
+      return Snapshot::FORMAT_ERROR;
+
+    uint32_t total {0};
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+    {
+      if ( !Snapshot::get(reader, sum, sizeof(entries[t]), &entries[t]) )
+        return Snapshot::FORMAT_ERROR;
+      if ( entries[t].state > Track::TURNING_OFF )
+        return Snapshot::FORMAT_ERROR;
+      total += entries[t].count;
+    }
+    if ( total > S::SIZE )
+      return Snapshot::TOO_LARGE;
+    uint32_t arena;
+    if ( !Snapshot::get(reader, sum, sizeof(arena), &arena) )
+      return Snapshot::FORMAT_ERROR;
+    uint8_t *payloads {sequence.getArena().restore(arena)};
+    if ( !payloads )
+      return Snapshot::TOO_LARGE;
+    if ( !Snapshot::get(reader, sum, arena, payloads) )
+      return fail(sequence, Snapshot::FORMAT_ERROR);
+    return 1;
+  }
+
+  // loads at most budget events. 1 while there are more, 0 once the
+  // sequence is complete, an error, with the sequence left cleared,
+  // otherwise
+  int8_t loadSlice(S &sequence, uint16_t budget)
+  {
+    while ( track < S::TRACKS )
+    {
+      if ( done == entries[track].count )
+      {
+        ++ track;
+        done = 0;
+        last = INT32_MIN;
+        continue;
+      }
+      if ( budget == 0 )
+        return 1;
+      uint32_t n {entries[track].count - done};
+      if ( n > budget )
+        n = budget;
+      bool complete {true};
+      const bool fitted {sequence.fill(track, n, [&](Event &event)
+      {
+        complete = Snapshot::get(reader, sum, sizeof(Event), &event) && complete;
+        ordered = ordered && event.position >= last;
+        last = event.position;
+      })};
+      if ( !fitted )
+        return fail(sequence, Snapshot::TOO_LARGE);
+      if ( !complete )
+        return fail(sequence, Snapshot::FORMAT_ERROR);
+      done += n;
+      budget -= n;
+    }
+
+    uint32_t checksum;
+    if ( reader.read(sizeof(checksum), reinterpret_cast<uint8_t *>(&checksum)) != sizeof(checksum) )
+      return fail(sequence, Snapshot::FORMAT_ERROR);
+    if ( checksum != sum.get() || !ordered )
+      return fail(sequence, Snapshot::CORRUPT);
+
+    sequence.setTicks(header.ticks);
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+    {
+      Track &settings {sequence.getTrack(t)};
+      settings.channel = entries[t].channel;
+      settings.length = entries[t].length;
+      settings.state = static_cast<decltype(settings.state)>(entries[t].state);
+      sequence.returnToZero(t);
+    }
+    return 0;
+  }
+};
+
+template<class S>
+int8_t Snapshot::load(KFile &file, S &sequence)
+{
+  SnapshotLoader<S> loader{file};
+  int8_t result {loader.begin(sequence)};
+  while ( result > 0 )
+    result = loader.loadSlice(sequence, UINT16_MAX);
+  return result;
+}
+#endif
@@ -0,0 +1,157 @@
+#ifndef TEMPOMAP_HPP
+#define TEMPOMAP_HPP
+#include <stdint.h>
+#include "Event.hpp"
+
+// a stretch of the song with constant tempo and meter
+struct TempoSegment
+{
+  int32_t position;
+  int32_t measure_position; // where the meter took effect
+  uint64_t microseconds; // since the start, 32 bits would wrap after 71 minutes
+  uint32_t tempo;
+  uint16_t measure; // measure number at measure_position
+  uint8_t numerator;
+  uint8_t denominator;
+};
+
+template<uint8_t SEGMENTS>
+class TempoMap
+{
+private:
+  TempoSegment segment[SEGMENTS];
+  uint8_t count;
+  uint16_t ticks;
+
+  int32_t getMeasureLength(const TempoSegment &s) const
+  {
+    return static_cast<int32_t>(s.numerator) * ticks * 4 / s.denominator;
+  }
+
+  // last segment starting at or before position
+  const TempoSegment &find(const int32_t position) const
+  {
+    uint8_t lo {1};
+    uint8_t hi {count};
+    while ( lo < hi )
+    {
+      const uint8_t mid = (lo + hi) / 2;
+      if ( segment[mid].position <= position )
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return segment[lo - 1];
+  }
+
+public:
+  TempoMap()
+  {
+    clear(24);
+  }
+
+  void clear(const uint16_t t)
+  {
+    ticks = t;
+    count = 1;
+    segment[0].position = 0;
+    segment[0].measure_position = 0;
+    segment[0].microseconds = 0;
+    segment[0].tempo = 500000;
+    segment[0].measure = 0;
+    segment[0].numerator = 4;
+    segment[0].denominator = 4;
+  }
+
+  // events must arrive in position order; once the map is full later
+  // changes are dropped and the last segment is extrapolated
+  void add(const Event &event)
+  {
+    if ( event.getType() != Event::Tempo && event.getType() != Event::Meter )
+      return;
+    TempoSegment last {segment[count - 1]};
+    if ( event.position > last.position )
+    {
+      if ( count == SEGMENTS )
+        return;
+      TempoSegment &s {segment[count++]};
+      s = last;
+      s.position = event.position;
+      s.microseconds = last.microseconds +
+	static_cast<int64_t>(event.position - last.position) * last.tempo / ticks;
+    }
+    TempoSegment &s {segment[count - 1]};
+    if ( event.getType() == Event::Tempo )
+      s.tempo = event.getTempo();
+    else
+    {
+      // a meter change mid-measure starts a new one
+      const int32_t length {getMeasureLength(s)};
+      const int32_t elapsed {event.position - s.measure_position};
+      s.measure += (elapsed + length - 1) / length;
+      s.measure_position = event.position;
+      s.numerator = event.param0;
+      s.denominator = event.param1;
+    }
+  }
+
+  uint8_t getCount() const
+  {
+    return count;
+  }
+
+  const TempoSegment &getSegment(const int32_t position) const
+  {
+    return find(position);
+  }
+
+  uint64_t getMicroseconds(const int32_t position) const
+  {
+    const TempoSegment &s {find(position)};
+    return s.microseconds + static_cast<int64_t>(position - s.position) * s.tempo / ticks;
+  }
+
+  int32_t getPosition(const uint64_t microseconds) const
+  {
+    uint8_t lo {1};
+    uint8_t hi {count};
+    while ( lo < hi )
+    {
+      const uint8_t mid = (lo + hi) / 2;
+      if ( segment[mid].microseconds <= microseconds )
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    const TempoSegment &s {segment[lo - 1]};
+    return s.position + (microseconds - s.microseconds) * ticks / s.tempo;
+  }
+
+  uint16_t getMeasure(const int32_t position) const
+  {
+    const TempoSegment &s {find(position)};
+    return s.measure + (position - s.measure_position) / getMeasureLength(s);
+  }
+
+  int32_t getMeasurePosition(const uint16_t measure) const
+  {
+    uint8_t lo {1};
+    uint8_t hi {count};
+    while ( lo < hi )
+    {
+      const uint8_t mid = (lo + hi) / 2;
+      if ( segment[mid].measure <= measure )
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    const TempoSegment &s {segment[lo - 1]};
+    return s.measure_position + (measure - s.measure) * getMeasureLength(s);
+  }
+
+  uint64_t getMeasureMicroseconds(const uint16_t measure) const
+  {
+    return getMicroseconds(getMeasurePosition(measure));
+  }
+};
+#endif
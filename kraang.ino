@@ -5,6 +5,10 @@
 #include "Buffer.hpp"
 #include "Sequence.hpp"
 #include "MIDIFile.hpp"
+#include "MIDIWriter.hpp"
+#include "MIDIStream.hpp"
+#include "Snapshot.hpp"
+#include "MIDIOutQueue.hpp"
 #include "Player.hpp"
 
 // system globals
@@ -14,8 +18,99 @@ Adafruit_RGBLCDShield lcd;
 
 class ArduinoMIDIPort : public MIDIPort
 {
+private:
+  static const uint8_t DUMPS = 8;
+  static const uint16_t QUEUE = 256;
+  static const uint16_t HELD = 256;
+  // the longest channel message
+  static const uint8_t MESSAGE = 3;
+
+  // what is left to queue of a SysEx dump; the bytes stay in the arena.
+  // held_before counts the held bytes that were sent ahead of it
+  struct Dump
+  {
+    const uint8_t *data;
+    uint16_t left;
+    uint16_t held_before;
+    bool started;
+  };
+
+  MIDIOutQueue<QUEUE> queue;
+  // messages sent while a dump is still going out wait here, so they
+  // don't land in the middle of it
+  MIDIOutQueue<HELD> held;
+  Dump dumps[DUMPS];
+  uint8_t first_dump;
+  uint8_t dump_count;
+  bool batching;
+  uint32_t dropped;
+
+  // queues the pending dumps and held bytes, in the order they were
+  // sent, as far as the queue has room
+  void feed()
+  {
+    for ( ;; )
+    {
+      if ( dump_count > 0 && dumps[first_dump].held_before == 0 )
+      {
+        Dump &dump {dumps[first_dump]};
+        const uint16_t n {queue.pushBytes(dump.data, dump.left)};
+        dump.started |= n > 0;
+        dump.data += n;
+        dump.left -= n;
+        if ( dump.left > 0 )
+          return;
+        first_dump = (first_dump + 1) % DUMPS;
+        dump_count --;
+      }
+      else if ( !held.isEmpty() && queue.getCount() < QUEUE )
+      {
+        const uint8_t byte {held.pop()};
+        queue.pushBytes(&byte, 1);
+        for ( uint8_t i {0}; i < dump_count; ++i )
+          dumps[(first_dump + i) % DUMPS].held_before --;
+      }
+      else
+        return;
+    }
+  }
+
+  // ends the pending dumps early: one already on the line is closed with
+  // EOX, so the receiver drops it, the others are left out
+  void cut()
+  {
+    static const uint8_t EOX {0xF7};
+    uint8_t kept {0};
+    if ( dump_count > 0 && dumps[first_dump].started )
+    {
+      dumps[first_dump].data = &EOX;
+      dumps[first_dump].left = 1;
+      kept = 1;
+    }
+    dropped += dump_count;
+    dump_count = kept;
+  }
+
+  // room for one more message, so none is ever dropped and no NoteOff
+  // lost. A full held queue cuts the dumps short so it can drain; the
+  // bytes ahead then go out with a blocking write, the one place this
+  // port waits, for about a message's wire time
+  void makeRoom(const bool behind_dump)
+  {
+    if ( behind_dump && held.getCount() > HELD - MESSAGE )
+      cut();
+    while ( behind_dump ? held.getCount() > HELD - MESSAGE
+                        : queue.getCount() > QUEUE - MESSAGE )
+    {
+      if ( queue.getCount() > QUEUE - MESSAGE )
+        Serial1.write(queue.pop());
+      else
+        feed();
+    }
+  }
+
 public:
-  ArduinoMIDIPort()
+  ArduinoMIDIPort() : first_dump{0}, dump_count{0}, batching{false}, dropped{0}
   {
   }
 
@@ -25,26 +120,96 @@ public:
     reset();
   }
 
+  void beginTick()
+  {
+    batching = true;
+  }
+
   void send(const uint8_t channel, const Event &event)
   {
-    Serial1.write(event.type | channel);
-    Serial1.write(event.param1);
-    if ( event.type != Event::ProgChange )
-      Serial1.write(event.param2);
+    const bool behind_dump {dump_count > 0 || !held.isEmpty()};
+    makeRoom(behind_dump);
+    if ( behind_dump )
+      held.push(channel, event);
+    else
+      queue.push(channel, event);
+    if ( !batching )
+      pump();
+  }
+
+  void flush()
+  {
+    batching = false;
+    pump();
+  }
+
+  // runs in the tick, so it never waits for the UART: what does not fit
+  // the queue now follows on later ticks and from loop(). With DUMPS
+  // dumps already pending, the new one is dropped
+  void sendSysEx(const uint8_t *data, const uint16_t length)
+  {
+    if ( length == 0 )
+      return;
+    if ( dump_count == DUMPS )
+    {
+      dropped ++;
+      return;
+    }
+    dumps[(first_dump + dump_count++) % DUMPS] = Dump{data, length, held.getCount(), false};
+    // a message held after the dump can't go on the running status of
+    // one held before it
+    held.clearRunningStatus();
+    feed();
+    if ( !batching )
+      pump();
+  }
+
+  // moves queued bytes into the UART as far as its buffer has room
+  void pump()
+  {
+    for ( ;; )
+    {
+      while ( !queue.isEmpty() && Serial1.availableForWrite() > 0 )
+        Serial1.write(queue.pop());
+      if ( !queue.isEmpty() || (dump_count == 0 && held.isEmpty()) )
+        return;
+      feed();
+    }
+  }
+
+  uint32_t getBacklog() const
+  {
+    uint32_t pending {0};
+    for ( uint8_t i {0}; i < dump_count; ++i )
+      pending += dumps[(first_dump + i) % DUMPS].left;
+    return queue.getBacklog() + held.getBacklog() +
+           pending * MIDIOutQueue<QUEUE>::BYTE_MICROSECONDS;
+  }
+
+  // dumps left out or cut short to keep the messages behind them moving
+  uint32_t getDropped() const
+  {
+    return dropped;
+  }
+
+  // true once every byte, dumps included, is in the UART
+  bool isEmpty() const
+  {
+    return queue.isEmpty() && held.isEmpty() && dump_count == 0;
   }
 
   void reset()
   {
+    dump_count = 0;
+    while ( !held.isEmpty() )
+      held.pop();
     for ( uint8_t i {0}; i < 15; ++i )
     {
-      // all notes off
-      Serial1.write(static_cast<uint8_t>(0xB0 | i));
-      Serial1.write(static_cast<uint8_t>(0x78));
-      Serial1.write(static_cast<uint8_t>(0x00));
+      send(i, Event::allNotesOff());
       // reset all controllers
-      Serial1.write(static_cast<uint8_t>(0xB0 | i));
-      Serial1.write(static_cast<uint8_t>(0x79));
-      Serial1.write(static_cast<uint8_t>(0x00));
+      send(i, Event{0, Event::Expression, 0, 0x79, 0x00});
+      while ( !isEmpty() )
+        pump();
     }
   }
 };
@@ -74,9 +239,10 @@ public:
     return f.read();
   }
 
-  void read(uint32_t length, uint8_t *data)
+  uint32_t read(uint32_t length, uint8_t *data)
   {
-    f.read(data, length);
+    const int n {f.read(data, length)};
+    return n > 0 ? n : 0;
   }
 
   uint32_t getPosition()
@@ -88,22 +254,94 @@ public:
   {
     f.seek(f.position() + position);
   }
+
+  uint32_t size()
+  {
+    return f.size();
+  }
+};
+
+class ArduinoOutFile : public KOutFile
+{
+private:
+  File f;
+public:
+  ArduinoOutFile(const char *path)
+  {
+    f = sd.open(path, O_WRONLY | O_CREAT | O_TRUNC);
+  }
+
+  bool isValid()
+  {
+    return f ? true : false;
+  }
+
+  void close()
+  {
+    f.close();
+  }
+
+  uint32_t write(uint32_t length, const uint8_t *data)
+  {
+    const int n {f.write(data, length)};
+    return n > 0 ? n : 0;
+  }
+
+  uint32_t getPosition()
+  {
+    return f.position();
+  }
+
+  void seek(uint32_t position)
+  {
+    f.seek(position);
+  }
 };
 
 // application globals
 ArduinoMIDIPort midi_port;
-Sequence sequence;
-Player player{sequence, midi_port};
+uint32_t port_dropped {0};
+// one song plays while the next is read into the other. The host's
+// Sequence is too large to hold twice, so the board's songs are smaller;
+// SONG_RAM is what both may take of the SAMD51's 192KB, the rest going
+// to the queues, the SD and LCD drivers, the loaders and the stack
+typedef BasicSequence<int16_t, 5120, 17> Song;
+const uint32_t SONG_RAM {160 * 1024};
+static_assert(2 * sizeof(Song) <= SONG_RAM, "two songs do not fit the RAM budget");
+Song songs[2];
+BasicRecorder<Song> recorder{songs[0], midi_port, midi_port};
+BasicPlayer<Song> player{songs[0], midi_port, recorder};
+// the song being read in the background, if any, from a MIDI file or a
+// snapshot
+ArduinoFile *next_file {0};
+MIDIFile *next_midi {0};
+SnapshotLoader<Song> *next_snapshot {0};
+// songs larger than this are streamed a few measures at a time; a file
+// takes about three bytes an event, so smaller ones fit a song
+const uint32_t STREAM_SIZE {3 * Song::SIZE};
+ArduinoFile *stream_file {0};
+MIDIStream<> *stream {0};
+Song *streamed {0};
+uint32_t stream_dropped {0};
 
 void TC3_Handler()
 {
   Adafruit_ZeroTimer::timerHandler(3);
 }
 
+uint32_t timer_target;
+
 void TimerCallback0(void)
 {
-  player.tick();
-  zerotimer.setCompare(0, player.getDelay() * 48 / 8);
+  player.advanceTo(timer_target);
+  // sleep through idle ticks, as far as the 16 bit compare reaches,
+  // unless bytes the UART had no room for still need feeding to it
+  uint32_t ticks {midi_port.isEmpty() ? player.getIdleTicks() + 1 : 1};
+  const uint32_t max_ticks {65535 / (player.getDelay() * 48 / 8)};
+  if ( ticks > max_ticks )
+    ticks = max_ticks > 0 ? max_ticks : 1;
+  timer_target = player.getPosition() + ticks;
+  zerotimer.setCompare(0, ticks * player.getDelay() * 48 / 8);
 }
 
 void setup()
@@ -129,6 +367,7 @@ void setup()
 void start_timer()
 {
   player.returnToZero();
+  timer_target = 1;
   
   uint16_t compare = player.getDelay() * 48 / 8;
   zerotimer.enable(false);
@@ -163,9 +402,20 @@ bool nextFileName(SdFile &dir, char longname[16], char shortname[13])
   return false;
 }
 
-void ui_choose_file()
+// the song not playing, free to load into once no switch is pending
+Song &idle_song()
+{
+  return &player.getSequence() == &songs[0] ? songs[1] : songs[0];
+}
+
+bool is_snapshot(const char *shortname)
+{
+  const char *extension {strrchr(shortname, '.')};
+  return extension && !strcmp(extension, ".KRS");
+}
+
+void ui_pick_file(char shortname[13])
 {
-  char shortname[13];
   SdFile dir;
   dir.open("/", O_RDONLY);
   while ( true )
@@ -189,9 +439,71 @@ void ui_choose_file()
       break;
     while ( lcd.readButtons() );
   }
+}
+
+void stop_stream()
+{
+  delete stream;
+  delete stream_file;
+  stream = 0;
+  stream_file = 0;
+  streamed = 0;
+  stream_dropped = 0;
+}
+
+// keeps the streamed song a few measures ahead of the playhead, a few
+// batches a pass; only the commits hold off the tick
+void stream_slice()
+{
+  for ( uint8_t i{0}; i < 8; ++i )
+  {
+    const bool read {stream->prefetch(player.getPosition())};
+    noInterrupts();
+    const bool current {&player.getSequence() == streamed};
+    // a dump still going out reads from its event's payload, so nothing
+    // played is dropped until the port has caught up
+    if ( current )
+      stream->commit(*streamed, player.getPosition(), midi_port.isEmpty());
+    interrupts();
+    // a queued song took over
+    if ( !current )
+    {
+      stop_stream();
+      return;
+    }
+    if ( !read )
+      break;
+  }
+  if ( stream->getDropped() != stream_dropped )
+  {
+    stream_dropped = stream->getDropped();
+    Serial.println("SysEx dropped, arena full");
+  }
+}
+
+// drops the song being read in the background
+void stop_loading()
+{
+  delete next_midi;
+  delete next_snapshot;
+  delete next_file;
+  next_midi = 0;
+  next_snapshot = 0;
+  next_file = 0;
+}
+
+void ui_choose_file()
+{
+  char shortname[13];
+  ui_pick_file(shortname);
+  stop_stream();
+  // a song queued or still loading would take over from the chosen one
+  player.unqueue();
+  stop_loading();
   lcd.clear();
   lcd.setCursor(0,0);
   lcd.print("    Loading...  ");
+  Song &sequence {player.getSequence()};
   
   // load sequence
   Serial.println("Opening MIDI file");
@@ -200,10 +512,35 @@ void ui_choose_file()
     Serial.println("File Valid");
   else
     Serial.println("File Invalid");
-  Serial.println("Loading reader");
-  MIDIFile midi_file{file};
-  Serial.println("Reading MIDI file");
-  midi_file.import(sequence);
+  // a saved session loads without parsing
+  if ( is_snapshot(shortname) )
+  {
+    Serial.println("Loading snapshot");
+    if ( Snapshot::load(file, sequence) )
+      Serial.println("Snapshot invalid");
+  }
+  else if ( file.size() > STREAM_SIZE )
+  {
+    Serial.println("Streaming MIDI file");
+    file.close();
+    stream_file = new ArduinoFile{shortname};
+    stream = new MIDIStream<>{*stream_file};
+    streamed = &sequence;
+    if ( stream->open(sequence) )
+    {
+      Serial.println("Stream invalid");
+      stop_stream();
+    }
+    else
+      stream->refill(sequence, 0);
+  }
+  else
+  {
+    Serial.println("Loading reader");
+    MIDIFile midi_file{file};
+    Serial.println("Reading MIDI file");
+    midi_file.import(sequence);
+  }
   Serial.print("Ticks: ");
   Serial.println(sequence.getTicks());
   Serial.print("Delay: ");
@@ -215,6 +552,79 @@ void ui_choose_file()
   lcd.clear();
 }
 
+// picks the song to play after this one; it is read a slice at a time
+// from loop() while this one keeps playing, and takes over at a measure
+void ui_queue_file()
+{
+  char shortname[13];
+  ui_pick_file(shortname);
+  lcd.clear();
+  Song &next {idle_song()};
+  next_file = new ArduinoFile{shortname};
+  if ( is_snapshot(shortname) )
+  {
+    next_snapshot = new SnapshotLoader<Song>{*next_file};
+    if ( next_snapshot->begin(next) < 0 )
+    {
+      Serial.println("Snapshot invalid");
+      stop_loading();
+    }
+    return;
+  }
+  // would not fit the sequence, and the stream is kept for the song
+  // that plays
+  if ( next_file->size() > STREAM_SIZE )
+  {
+    Serial.println("Too large to queue");
+    stop_loading();
+    return;
+  }
+  next_midi = new MIDIFile{*next_file};
+  next_midi->beginImport(next);
+}
+
+// reads the queued song for at most 20ms
+void load_slice()
+{
+  Song &next {idle_song()};
+  const uint32_t until {millis() + 20};
+  int8_t result;
+  do
+  {
+    result = next_midi ? next_midi->importSlice(next, 16)
+                       : next_snapshot->loadSlice(next, 64);
+  } while ( result > 0 && millis() < until );
+  if ( result > 0 )
+    return;
+  if ( result == 0 )
+  {
+    noInterrupts();
+    player.queue(next);
+    interrupts();
+  }
+  else
+    Serial.println("Queued file invalid");
+  stop_loading();
+}
+
+void ui_save_session()
+{
+  const Song &sequence {player.getSequence()};
+  lcd.clear();
+  lcd.setCursor(0,0);
+  lcd.print("    Saving...   ");
+  {
+    ArduinoOutFile file{"SESSION.MID"};
+    MIDIWriter writer{file};
+    if ( writer.save(sequence) )
+      Serial.println("Save failed");
+  }
+  // and as a snapshot, for loading it back quickly
+  ArduinoOutFile snapshot{"SESSION.KRS"};
+  if ( Snapshot::save(snapshot, sequence) )
+    Serial.println("Snapshot failed");
+}
+
 void loop()
 {
   if ( player.visualsChanged() )
@@ -229,13 +639,50 @@ void loop()
     lcd.setCursor(0,1);
     lcd.print(text);
   }
-  delay(100);
+  noInterrupts();
+  midi_port.pump();
+  const uint32_t dropped {midi_port.getDropped()};
+  interrupts();
+  if ( dropped != port_dropped )
+  {
+    port_dropped = dropped;
+    Serial.println("SysEx cut short, MIDI out busy");
+  }
+  // a few nodes at a time so the tick is held off only briefly
+  for ( uint8_t i{0}; i < 16; ++i )
+  {
+    noInterrupts();
+    const bool done {player.getSequence().compact(4)};
+    interrupts();
+    if ( done )
+      break;
+  }
+  if ( stream )
+    stream_slice();
+  if ( next_midi || next_snapshot )
+    load_slice();
+  else
+    delay(100);
 
   uint8_t buttons = lcd.readButtons();
-  if ( buttons )
+  // right queues the next song without stopping, once the last is in
+  if ( buttons == BUTTON_RIGHT )
+  {
+    while ( lcd.readButtons() );
+    if ( !next_midi && !next_snapshot && !player.isQueued() )
+      ui_queue_file();
+  }
+  else if ( buttons )
   {
     stop_timer();
-    midi_port.reset();
+    // only the notes still sounding
+    player.stop();
+    // dumps still going out point into the song about to be replaced
+    while ( !midi_port.isEmpty() )
+      midi_port.pump();
+    // left keeps what was recorded before the next song is chosen
+    if ( buttons & BUTTON_LEFT )
+      ui_save_session();
     ui_choose_file();
   }
 /*  Serial.print(player.getBpm());
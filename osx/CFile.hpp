@@ -28,9 +28,9 @@ public:
     return fgetc(fp);
   }
 
-  void read(uint32_t length, uint8_t *data)
+  uint32_t read(uint32_t length, uint8_t *data)
   {
-    fread(data, length, 1, fp);
+    return fread(data, 1, length, fp);
   }
 
   uint32_t getPosition()
@@ -0,0 +1,43 @@
+#include <stdio.h>
+#include "../File.hpp"
+
+class COutFile : public KOutFile
+{
+private:
+  FILE *fp;
+  bool is_valid;
+public:
+  COutFile(const char *path)
+  {
+    fp = fopen(path, "wb");
+    is_valid = (fp != NULL);
+  }
+
+  bool isValid()
+  {
+    return is_valid;
+  }
+
+  void close()
+  {
+    if ( fp )
+      fclose(fp);
+    fp = NULL;
+  }
+
+  uint32_t write(uint32_t length, const uint8_t *data)
+  {
+    return fp ? fwrite(data, 1, length, fp) : 0;
+  }
+
+  uint32_t getPosition()
+  {
+    return fp ? ftell(fp) : 0;
+  }
+
+  void seek(uint32_t position)
+  {
+    if ( fp )
+      fseek(fp, position, SEEK_SET);
+  }
+};
@@ -0,0 +1,89 @@
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../File.hpp"
+
+// maps the whole file so readers parse straight out of the page cache
+class MMapFile : public KFile
+{
+private:
+  uint8_t *data;
+  uint32_t size;
+  uint32_t position;
+public:
+  MMapFile(const char *path) : data{NULL}, size{0}, position{0}
+  {
+    const int fd {open(path, O_RDONLY)};
+    if ( fd < 0 )
+      return;
+    struct stat st;
+    if ( fstat(fd, &st) == 0 && st.st_size > 0 )
+    {
+      void *map {mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)};
+      if ( map != MAP_FAILED )
+      {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        data = static_cast<uint8_t *>(map);
+        size = st.st_size;
+      }
+    }
+    ::close(fd);
+  }
+
+  ~MMapFile()
+  {
+    close();
+  }
+
+  bool isValid()
+  {
+    return data != NULL;
+  }
+
+  void close()
+  {
+    if ( data != NULL )
+      munmap(data, size);
+    data = NULL;
+    size = 0;
+    position = 0;
+  }
+
+  uint8_t readByte()
+  {
+    return position < size ? data[position++] : 0;
+  }
+
+  uint32_t read(uint32_t length, uint8_t *out)
+  {
+    if ( length > size - position )
+      length = size - position;
+    memcpy(out, data + position, length);
+    position += length;
+    return length;
+  }
+
+  uint32_t getPosition()
+  {
+    return position;
+  }
+
+  void seek(int32_t offset)
+  {
+    position += offset;
+    if ( position > size )
+      position = size;
+  }
+
+  const uint8_t *getData()
+  {
+    return data;
+  }
+
+  uint32_t getSize()
+  {
+    return size;
+  }
+};
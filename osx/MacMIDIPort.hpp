@@ -1,6 +1,7 @@
 #include "../Player.hpp"
 #include <CoreMIDI/CoreMIDI.h>
 #include <iostream>
+#include <mutex>
 
 using namespace std;
 
@@ -15,12 +16,31 @@ private:
   MIDIPortRef MIDIOutPort;
   MIDIEndpointRef MIDIDest;
   MIDIEndpointRef MIDISource;
+  // input passthru sends from the CoreMIDI thread
+  mutex lock;
+  bool batching;
+  Byte list_data[1024];
+  MIDIPacketList *list;
+  MIDIPacket *packet;
+
+  void sendList()
+  {
+    if ( list->numPackets > 0 )
+    {
+      //MIDIReceived(MIDIOutput, list);
+      MIDISend(MIDIOutPort, MIDIDest, list);
+      played = true;
+    }
+    packet = MIDIPacketListInit(list);
+  }
 
 public:
   bool played;
 
-  MacMIDIPort(const int out_port, const int in_port) : played{false}
+  MacMIDIPort(const int out_port, const int in_port)
+    : batching{false}, list{reinterpret_cast<MIDIPacketList *>(list_data)}, played{false}
   {
+    packet = MIDIPacketListInit(list);
     MIDIClientCreate(CFSTR("analoq.kraang"), NULL, NULL, &MIDIClient);
     MIDIInputPortCreate(MIDIClient, CFSTR("Input port"), MidiHandler, this, &MIDIInPort);
     MIDIOutputPortCreate(MIDIClient, CFSTR("Output port"), &MIDIOutPort);
@@ -35,25 +55,52 @@ public:
     MIDIClientDispose(MIDIClient);
   }
 
+  void beginTick()
+  {
+    lock_guard<mutex> guard{lock};
+    batching = true;
+  }
+
+  // events with equal timestamps share one packet, so a tick is a
+  // single MIDISend however many events it holds
   void send(uint8_t channel, const Event &event)
   {
-    MIDIPacketList pktlist;
-    MIDIPacket *packet = MIDIPacketListInit(&pktlist);
+    lock_guard<mutex> guard{lock};
     unsigned char data[3];
     data[0] = event.getType() | channel;
     data[1] = event.param1;
     data[2] = event.param2;
-    switch ( event.getType() )
+    const ByteCount length {event.getType() == Event::ProgChange ||
+                            event.getType() == Event::AfterTouch ? 2u : 3u};
+    packet = MIDIPacketListAdd(list, sizeof(list_data), packet, 0, length, data);
+    if ( packet == NULL )
+    {
+      sendList();
+      packet = MIDIPacketListAdd(list, sizeof(list_data), packet, 0, length, data);
+    }
+    if ( !batching )
+      sendList();
+  }
+
+  void flush()
+  {
+    lock_guard<mutex> guard{lock};
+    batching = false;
+    sendList();
+  }
+
+  // after what is pending, in packets of its own small enough for the list
+  void sendSysEx(const uint8_t *data, const uint16_t length)
+  {
+    lock_guard<mutex> guard{lock};
+    sendList();
+    for ( uint16_t done {0}; done < length; )
     {
-      case Event::ProgChange:
-	MIDIPacketListAdd(&pktlist, sizeof(MIDIPacket), packet, 0, 2, data);
-        break;
-      default:
-        MIDIPacketListAdd(&pktlist, sizeof(MIDIPacket), packet, 0, 3, data);
+      const uint16_t n = length - done < 256 ? length - done : 256;
+      packet = MIDIPacketListAdd(list, sizeof(list_data), packet, 0, n, data + done);
+      sendList();
+      done += n;
     }
-    //MIDIReceived(MIDIOutput, &pktlist);
-    MIDISend(MIDIOutPort, MIDIDest, &pktlist);
-    played = true;
   }
 };
 
@@ -0,0 +1,136 @@
+#include <atomic>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <string.h>
+#include "../MIDIFile.hpp"
+
+using namespace std;
+
+// decodes each MTrk chunk on a worker thread, then replays the decoded
+// events into the sequence in chunk order so the result is identical to
+// MIDIFile::import
+class ParallelMIDIFile
+{
+private:
+  struct Chunk
+  {
+    uint32_t offset;
+    uint32_t size;
+    int8_t result;
+    vector<pair<uint8_t, Event>> events;
+    // payloads behind their length, the events holding their offset
+    vector<uint8_t> payloads;
+
+    void appendEvent(const uint8_t track, const Event &event)
+    {
+      events.push_back(make_pair(track, event));
+    }
+
+    uint8_t *appendPayload(const uint8_t track, const Event &event, const uint16_t length)
+    {
+      Event stored {event};
+      const uint32_t offset {static_cast<uint32_t>(payloads.size())};
+      stored.setOffset(offset);
+      events.push_back(make_pair(track, stored));
+      payloads.resize(offset + 2 + length);
+      payloads[offset] = length >> 8;
+      payloads[offset + 1] = length & 0xFF;
+      return payloads.data() + offset + 2;
+    }
+  };
+
+  KFile &fp;
+  unsigned threads;
+
+public:
+  ParallelMIDIFile(KFile &fp, unsigned t = thread::hardware_concurrency())
+    : fp{fp}, threads{t > 0 ? t : 1}
+  {
+  }
+
+  ~ParallelMIDIFile()
+  {
+    fp.close();
+  }
+
+  template<class S>
+  int8_t import(S &sequence)
+  {
+    // chunks are decoded from memory, so unmapped files are read whole
+    vector<uint8_t> copy;
+    const uint8_t *data {fp.getData()};
+    uint32_t size {fp.getSize()};
+    if ( data == NULL )
+    {
+      uint8_t block[4096];
+      uint32_t n;
+      while ( (n = fp.read(sizeof(block), block)) > 0 )
+        copy.insert(copy.end(), block, block + n);
+      data = copy.data();
+      size = copy.size();
+    }
+
+    // chunk table
+    FileReader<> header{data, size};
+    header.skip(8); // MThd, size
+    header.readInt(2); // format
+    const int16_t tracks = header.readInt(2);
+    const int16_t ticks = header.readInt(2);
+    vector<Chunk> chunks(tracks > 0 ? tracks : 0);
+    for ( Chunk &chunk : chunks )
+    {
+      header.skip(4); // MTrk
+      chunk.size = header.readInt(4);
+      chunk.offset = header.getPosition();
+      // a corrupt length would wrap offset + size
+      if ( chunk.size > size - chunk.offset )
+        chunk.size = size - chunk.offset;
+      header.skip(chunk.size);
+    }
+
+    atomic<size_t> next {0};
+    auto worker = [&]()
+    {
+      for ( size_t i; (i = next++) < chunks.size(); )
+      {
+        Chunk &chunk {chunks[i]};
+        FileReader<> reader{data + chunk.offset, chunk.size};
+        chunk.result = MIDIFile::decodeTrack(reader, chunk.size, chunk);
+      }
+    };
+    vector<thread> pool;
+    for ( unsigned i {1}; i < threads && i < chunks.size(); ++i )
+      pool.push_back(thread(worker));
+    worker();
+    for ( thread &t : pool )
+      t.join();
+
+    sequence.clear();
+    sequence.setTicks(ticks);
+    for ( const Chunk &chunk : chunks )
+    {
+      for ( const pair<uint8_t, Event> &event : chunk.events )
+      {
+        if ( event.first >= S::TRACKS )
+          continue;
+        const Event::Type type {event.second.getType()};
+        if ( type != Event::SysEx && type != Event::Meta )
+        {
+          sequence.appendEvent(event.first, event.second);
+          continue;
+        }
+        const uint8_t *payload {chunk.payloads.data() + event.second.getOffset()};
+        const uint16_t length = payload[0] << 8 | payload[1];
+        uint8_t *stored {sequence.appendPayload(event.first, event.second, length)};
+        if ( stored )
+          memcpy(stored, payload + 2, length);
+      }
+      if ( chunk.result )
+        return chunk.result;
+    }
+    for ( uint8_t t {0}; t < S::TRACKS; ++t )
+      sequence.returnToZero(t);
+    return 0;
+  }
+};
@@ -1,7 +1,8 @@
 #include "../Sequence.hpp"
 #include "../Recorder.hpp"
 #include "../Player.hpp"
-#include "CFile.hpp"
+#include "../Clock.hpp"
+#include "MMapFile.hpp"
 #include "CTiming.hpp"
 #include "MacMIDIPort.hpp"
 #include "../MIDIFile.hpp"
@@ -25,26 +26,29 @@ int main(int argc, char *argv[])
   MacMIDIPort midi_port{0, 0};
   Sequence sequence;
   CTiming timing;
-  CFile file{argv[1]};
+  MMapFile file{argv[1]};
   MIDIFile midi_file{file};
   midi_file.import(sequence);
-  Recorder recorder{sequence, midi_port};
+  Recorder recorder{sequence, midi_port, midi_port};
   Player player{sequence, midi_port, recorder};
   cout << "Ticks: " << sequence.getTicks() << endl;
   cin.ignore(1);
-  int count = 0;
   player.play();
-  while (player.tick())
+  // sleep straight through ticks with nothing to send
+  Clock<CTiming> clock{timing};
+  uint32_t ticks {1};
+  while ( player.advanceTo(player.getPosition() + ticks) )
   {
-    uint32_t start {timing.getMicroseconds()};
-    if ( count++ % sequence.getTicks() == 0 )
+    if ( player.visualsChanged() )
     {
       cout << fixed << setw(4) << setprecision(1) << player.getBpm() << "\t"
            << fixed << setw(3) << player.getMeasure()+1 << ":"
   	   << fixed << setw(2) << static_cast<int>(player.getBeat()+1) << "\n";
     }
-    while ( timing.getMicroseconds() - start < player.getDelay() )
-      timing.delay(10);
+    ticks = player.getIdleTicks() + 1;
+    clock.advance(ticks, player.getTempo(), sequence.getTicks());
+    clock.wait();
   }
+  cout << "Max lateness: " << clock.getMaxLateness() << "us" << endl;
   return 0;
 }
@@ -1,15 +1,19 @@
 #include <cmath>
 #include <thread>
 #include <chrono>
+#include <iostream>
 #include <ncurses.h>
-#define CATCH_CONFIG_MAIN
 #include "../Sequence.hpp"
 #include "../Player.hpp"
 #include "../Recorder.hpp"
+#include "../Clock.hpp"
+#include "../MIDIWriter.hpp"
+#include "COutFile.hpp"
 #include "MacMIDIPort.hpp"
 #include "CTiming.hpp"
 
 bool MidiInput {false};
+CTiming timing;
 MacMIDIPort midi_port{0, 1};
 Sequence sequence;
 Recorder recorder{sequence, midi_port, midi_port};
@@ -43,7 +47,7 @@ static void MidiHandler(const MIDIPacketList *packetList, void *readProcRefCon,
       param2 = message[j++];
       if ( type == Event::NoteOn && param2 == 0 )
 	type = Event::NoteOff;
-      recorder.receiveEvent(Event{0, type, 0, param1, param2});
+      recorder.receiveEvent(Event{0, type, 0, param1, param2}, timing.getMicroseconds());
     }
     packet = MIDIPacketNext(packet);
   }
@@ -53,13 +57,14 @@ static void MidiHandler(const MIDIPacketList *packetList, void *readProcRefCon,
 
 void play_thread()
 {
+  Clock<CTiming> clock{timing};
   for ( ;; )
   {
-    auto start = chrono::high_resolution_clock::now();
-    auto tick_time = chrono::microseconds(player.getDelay());
-    player.tick();
-    while ( chrono::high_resolution_clock::now() - start < tick_time )
-      this_thread::sleep_for(chrono::microseconds(500));
+    // the deadline is when the tick at the player's position is due
+    clock.wait();
+    player.setTickTime(clock.getDeadline());
+    player.advanceTo(player.getPosition() + 1);
+    clock.advance(1, player.getTempo(), sequence.getTicks());
   }
 }
 
@@ -78,12 +83,11 @@ void handle_track(const uint8_t t)
 
 int main(int argc, char *argv[])
 {
-  CTiming timing;
   // metronome
   recorder.initMetronome();
   
   // record track test
-  for ( int i = 0; i < TRACKS-4; i += 4 )
+  for ( int i = 0; i < Sequence::TRACKS-4; i += 4 )
   {
     sequence.getTrack(i+1).channel = 1;
     sequence.getTrack(i+2).channel = 2;
@@ -92,7 +96,7 @@ int main(int argc, char *argv[])
   }
 
   // turn tracks off
-  for ( int i = 1; i < TRACKS; i ++ )
+  for ( int i = 1; i < Sequence::TRACKS; i ++ )
     sequence.getTrack(i).state = Track::OFF;
 
   initscr();
@@ -248,5 +252,12 @@ int main(int argc, char *argv[])
   player.stop();
   endwin();
 
-  cout << sequence.getBuffer().dump() << endl;
+  // keep the session
+  const char *path {argc > 1 ? argv[1] : "session.mid"};
+  COutFile file{path};
+  MIDIWriter writer{file};
+  if ( writer.save(sequence) == 0 )
+    std::cout << "Saved " << path << std::endl;
+  else
+    std::cout << "Could not save " << path << std::endl;
 }
@@ -0,0 +1,63 @@
+#include "../Sequence.hpp"
+#include "../Renderer.hpp"
+#include "../MIDIFile.hpp"
+#include "MMapFile.hpp"
+#include <chrono>
+#include <fstream>
+#include <iostream>
+
+using namespace std;
+
+// renders a song offline and reports how fast; the messages go to a
+// text file, one "microseconds channel status param1 param2" a line
+int main(int argc, char *argv[])
+{
+  if ( argc != 2 && argc != 3 )
+  {
+    cout << "Usage: render <file.mid> [out.txt]" << endl;
+    return -1;
+  }
+  static Sequence sequence;
+  MMapFile file{argv[1]};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+
+  ofstream out;
+  if ( argc == 3 )
+  {
+    out.open(argv[2]);
+    if ( !out )
+    {
+      cout << "Cannot write " << argv[2] << endl;
+      return -1;
+    }
+  }
+  bool writing {argc == 3};
+  auto sink = [&](const RenderedEvent &r)
+  {
+    if ( writing )
+      out << r.time << ' ' << static_cast<int>(r.channel) << ' '
+          << static_cast<int>(r.event.getType()) << ' '
+          << static_cast<int>(r.event.param1) << ' '
+          << static_cast<int>(r.event.param2) << '\n';
+  };
+  BasicRenderer<Sequence, decltype(sink)> renderer{sequence, sink};
+  const uint32_t events {renderer.render()};
+  writing = false;
+
+  // render again until a second has gone by, for a steady figure
+  typedef chrono::steady_clock steady;
+  const steady::time_point start {steady::now()};
+  uint64_t total {0};
+  double seconds;
+  do
+  {
+    total += renderer.render();
+    seconds = chrono::duration<double>(steady::now() - start).count();
+  } while ( seconds < 1 );
+
+  cout << "Events: " << events << endl;
+  cout << "Length: " << renderer.getLength() / 1000 << "ms" << endl;
+  cout << "Events/s: " << static_cast<uint64_t>(total / seconds) << endl;
+  return 0;
+}
@@ -1,12 +1,25 @@
 #define CATCH_CONFIG_MAIN
 #include <iostream>
+#include <vector>
 #include "catch.hpp"
 #include "../Buffer.hpp"
+#include "../ChunkBuffer.hpp"
 #include "../Event.hpp"
 #include "../Sequence.hpp"
 #include "../MIDIFile.hpp"
+#include "../MIDIWriter.hpp"
+#include "../MIDIStream.hpp"
+#include "../Snapshot.hpp"
 #include "../Player.hpp"
+#include "../Clock.hpp"
+#include "../MIDIOutQueue.hpp"
+#include "../NoteTracker.hpp"
+#include "../Renderer.hpp"
 #include "CFile.hpp"
+#include "COutFile.hpp"
+#include "MMapFile.hpp"
+#include "ParallelMIDIFile.hpp"
+#include <thread>
 
 using namespace std;
 
@@ -103,7 +116,7 @@ TEST_CASE("New buffer is empty", "[buffer]")
   REQUIRE(buffer.getHead(0) == UNDEFINED);
   REQUIRE(buffer.getTail(0) == UNDEFINED);
   REQUIRE(buffer.getAvailable() == 0);
-  REQUIRE(buffer.dump() == "u:1:? u:2:? u:u:? ");
+  REQUIRE(buffer.dump() == "u:u:? u:u:? u:u:? ");
   REQUIRE(buffer.traverse(0) == "");
 }
 
@@ -112,7 +125,7 @@ TEST_CASE("Insert One Track", "[buffer]")
   Buffer<TestNode, 5, 1> buffer;
   buffer.insert(0, TestNode('C'));
   REQUIRE(buffer.getAvailable() == 1);
-  REQUIRE(buffer.dump() == "u:u:C u:2:? u:3:? u:4:? u:u:? ");
+  REQUIRE(buffer.dump() == "u:u:C u:u:? u:u:? u:u:? u:u:? ");
   REQUIRE(buffer.getHead(0) == 0);
   REQUIRE(buffer.getTail(0) == 0);
   REQUIRE(buffer.getPointer(0) == 0);
@@ -120,7 +133,7 @@ TEST_CASE("Insert One Track", "[buffer]")
 
   buffer.insert(0, TestNode('C'));
   REQUIRE(buffer.getAvailable() == 2);
-  REQUIRE(buffer.dump() == "1:u:C u:0:C u:3:? u:4:? u:u:? ");
+  REQUIRE(buffer.dump() == "1:u:C u:0:C u:u:? u:u:? u:u:? ");
   REQUIRE(buffer.getHead(0) == 1);
   REQUIRE(buffer.getTail(0) == 0);
   REQUIRE(buffer.getPointer(0) == 0);
@@ -128,7 +141,7 @@ TEST_CASE("Insert One Track", "[buffer]")
 
   buffer.insert(0, TestNode('D'));
   REQUIRE(buffer.getAvailable() == 3);
-  REQUIRE(buffer.dump() == "1:2:C u:0:C 0:u:D u:4:? u:u:? ");
+  REQUIRE(buffer.dump() == "1:2:C u:0:C 0:u:D u:u:? u:u:? ");
   REQUIRE(buffer.getHead(0) == 1);
   REQUIRE(buffer.getTail(0) == 2);
   REQUIRE(buffer.getPointer(0) == 0);
@@ -172,8 +185,18 @@ TEST_CASE("Buffer clear", "[buffer]")
   REQUIRE(buffer.getHead(0) == UNDEFINED);
   REQUIRE(buffer.getTail(0) == UNDEFINED);
   REQUIRE(buffer.getPointer(0) ==  UNDEFINED);
-  REQUIRE(buffer.dump() == "u:1:? u:2:? u:3:? u:u:? ");
+  REQUIRE(buffer.dump() == "u:u:? u:u:? u:u:? u:u:? ");
   REQUIRE(buffer.traverse(0) == "");
+
+  // nodes are handed out from the top again, reused ones first
+  buffer.insert(0,TestNode('E'));
+  buffer.insert(0,TestNode('F'));
+  buffer.remove(0);
+  REQUIRE(buffer.getAvailable() == 0);
+  buffer.insert(0,TestNode('G'));
+  buffer.insert(0,TestNode('H'));
+  REQUIRE(buffer.dump() == "1:2:G u:0:F 0:u:H u:u:? ");
+  REQUIRE(buffer.getCount() == 3);
 }
 
 TEST_CASE("Insert Two Track", "[buffer]")
@@ -269,7 +292,7 @@ TEST_CASE("Buffer deletion/insertion", "[buffer]")
   REQUIRE(buffer.getAvailable() == 0);
   REQUIRE(buffer.getHead(0) == UNDEFINED);
   REQUIRE(buffer.getTail(0) == UNDEFINED);
-  REQUIRE(buffer.dump() == "u:1:? u:2:? u:3:? u:4:? u:u:? ");
+  REQUIRE(buffer.dump() == "u:u:? u:u:? u:u:? u:u:? u:u:? ");
   REQUIRE(buffer.traverse(0) == "");
 
   buffer.clear();
@@ -290,7 +313,7 @@ TEST_CASE("Buffer deletion/insertion", "[buffer]")
   REQUIRE(buffer.getAvailable() == 0);
   REQUIRE(buffer.getHead(0) == 1);
   REQUIRE(buffer.getTail(0) == 3);
-  REQUIRE(buffer.dump() == "u:4:? u:2:B 1:3:C 2:u:D u:u:? ");
+  REQUIRE(buffer.dump() == "u:u:? u:2:B 1:3:C 2:u:D u:u:? ");
   REQUIRE(buffer.traverse(0) == "BCD");
 
 
@@ -343,6 +366,448 @@ TEST_CASE("Seek", "[buffer]")
   REQUIRE(buffer.get(0).value == 'F');
 }
 
+TEST_CASE("Indexed seek", "[buffer]")
+{
+  Buffer<TestNode, 64, 2, 4> buffer;
+  for ( int i{0}; i < 40; i += 2 )
+    buffer.append(0, TestNode(i));
+
+  for ( int i{0}; i < 38; ++i )
+  {
+    buffer.seek(0, TestNode(i));
+    REQUIRE(buffer.get(0).value == (i + 1) / 2 * 2);
+  }
+  buffer.seek(0, TestNode(50));
+  REQUIRE(buffer.getPointer(0) == buffer.getTail(0));
+
+  // removing checkpointed nodes keeps the index usable
+  for ( int i{0}; i < 40; i += 8 )
+  {
+    buffer.seek(0, TestNode(i));
+    buffer.remove(0);
+  }
+  for ( int i{0}; i < 38; ++i )
+  {
+    buffer.seek(0, TestNode(i));
+    int expected {(i + 1) / 2 * 2};
+    if ( expected % 8 == 0 )
+      expected += 2;
+    REQUIRE(buffer.get(0).value == expected);
+  }
+
+  // as do inserts behind the checkpoints
+  buffer.insert(0, TestNode(3));
+  buffer.insert(0, TestNode(17));
+  buffer.seek(0, TestNode(3));
+  REQUIRE(buffer.get(0).value == 3);
+  buffer.seek(0, TestNode(15));
+  REQUIRE(buffer.get(0).value == 17);
+  buffer.seek(0, TestNode(18));
+  REQUIRE(buffer.get(0).value == 18);
+  REQUIRE(buffer.traverse(0).size() == 17);
+
+  buffer.seek(1, TestNode(0));
+  REQUIRE(buffer.getPointer(1) == UNDEFINED);
+
+  // a gap filled far past its stride is split, and once the slots run
+  // out the track is laid out again
+  Buffer<TestNode, 128, 1, 8> crowded;
+  for ( int i{0}; i < 40; i += 1 )
+    crowded.append(0, TestNode(i * 2));
+  crowded.seek(0, TestNode(0));
+  for ( int i{0}; i < 38; ++i )
+  {
+    crowded.insert(0, TestNode(9));
+    crowded.seek(0, TestNode(10));
+    REQUIRE(crowded.get(0).value == 10);
+    // twice the stride of the last layout, which grows with the track
+    REQUIRE(crowded.getLongestGap(0) <= 2 * ((41 + i) / 8 + 1));
+  }
+
+  // gaps far longer than 255 nodes are counted in full, so inserts
+  // within twice the stride leave the layout alone
+  Buffer<TestNode, 8192, 1, 8, int32_t> lengthy;
+  for ( int i{0}; i < 4000; ++i )
+    lengthy.append(0, TestNode(i / 32));
+  lengthy.seek(0, TestNode(0));
+  for ( int i{0}; i < 300; ++i )
+  {
+    lengthy.insert(0, TestNode(40));
+    lengthy.seek(0, TestNode(41));
+    REQUIRE(lengthy.get(0).value == 41);
+    REQUIRE(lengthy.isIndexed(0));
+  }
+  REQUIRE(lengthy.getLongestGap(0) <= 2 * (4000 / 8 + 1));
+}
+
+TEST_CASE("Append", "[buffer]")
+{
+  Buffer<TestNode, 6, 2> buffer;
+  buffer.append(0, TestNode('B'));
+  REQUIRE(buffer.getHead(0) == 0);
+  REQUIRE(buffer.getTail(0) == 0);
+  REQUIRE(buffer.getPointer(0) == 0);
+
+  buffer.append(0, TestNode('C'));
+  buffer.append(0, TestNode('E'));
+  REQUIRE(buffer.dump() == "u:1:B 0:2:C 1:u:E u:u:? u:u:? u:u:? ");
+  REQUIRE(buffer.getTail(0) == 2);
+  REQUIRE(buffer.getPointer(0) == 0);
+
+  // out of order and equal data land where insert() would put them
+  buffer.append(0, TestNode('E'));
+  buffer.append(0, TestNode('A'));
+  buffer.append(1, TestNode('D'));
+  REQUIRE(buffer.traverse(0) == "ABCEE");
+  REQUIRE(buffer.getHead(0) == 4);
+  REQUIRE(buffer.getTail(0) == 2);
+  REQUIRE(buffer.getPointer(0) == 0);
+  REQUIRE(buffer.dump() == "4:1:B 0:3:C 3:u:E 1:2:E u:0:A u:u:D ");
+  REQUIRE(buffer.traverse(1) == "D");
+  REQUIRE(buffer.getCount() == 6);
+}
+
+TEST_CASE("Compact", "[buffer]")
+{
+  Buffer<TestNode, 6, 2> buffer;
+  buffer.insert(0, TestNode('B'));
+  buffer.insert(1, TestNode('X'));
+  buffer.insert(0, TestNode('D'));
+  buffer.insert(1, TestNode('Y'));
+  buffer.insert(0, TestNode('C'));
+  REQUIRE(buffer.dump() == "u:4:B u:3:X 4:u:D 1:u:Y 0:2:C u:u:? ");
+  REQUIRE_FALSE(buffer.compact(2));
+  REQUIRE(buffer.compact(100));
+  REQUIRE(buffer.dump() == "u:1:B 0:2:C 1:u:D u:4:X 3:u:Y u:u:? ");
+  REQUIRE(buffer.getPointer(0) == 0);
+  REQUIRE(buffer.getPointer(1) == 3);
+  REQUIRE(buffer.getTail(0) == 2);
+  REQUIRE(buffer.getAvailable() == 5);
+
+  // edits between slices, and seeks through the moved checkpoints
+  static Buffer<Event, 400, 3, 8> compacted;
+  static Buffer<Event, 400, 3, 8> plain;
+  uint32_t seed {7};
+  auto random = [&seed](const uint32_t n)
+  {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+  };
+  for ( uint16_t i{0}; i < 2000; ++i )
+  {
+    const uint8_t track = random(3);
+    if ( random(3) > 0 && plain.getCount() < 350 )
+    {
+      const Event event {static_cast<int32_t>(random(200)), Event::NoteOn, 0,
+                         static_cast<uint8_t>(i & 0x7F), 0};
+      plain.insert(track, event);
+      compacted.insert(track, event);
+    }
+    else if ( plain.notUndefined(track) )
+    {
+      plain.remove(track);
+      compacted.remove(track);
+    }
+    else
+    {
+      const Event event {static_cast<int32_t>(random(200)), Event::NoteOn, 0, 0, 0};
+      plain.seek(track, event);
+      compacted.seek(track, event);
+    }
+    compacted.compact(3);
+    REQUIRE(plain.notUndefined(track) == compacted.notUndefined(track));
+    if ( plain.notUndefined(track) )
+      REQUIRE(plain.get(track).param1 == compacted.get(track).param1);
+  }
+  while ( !compacted.compact(16) );
+  for ( uint8_t t{0}; t < 3; ++t )
+  {
+    REQUIRE(plain.traverse(t) == compacted.traverse(t));
+    compacted.seek(t, Event{100, Event::NoteOn, 0, 0, 0});
+    plain.seek(t, Event{100, Event::NoteOn, 0, 0, 0});
+    REQUIRE(plain.get(t).param1 == compacted.get(t).param1);
+  }
+  // a pass without edits folds the free nodes into the high-water mark
+  compacted.returnToZero(0);
+  compacted.remove(0);
+  REQUIRE(compacted.getAvailable() != compacted.getCount());
+  while ( !compacted.compact(16) );
+  while ( !compacted.compact(16) );
+  REQUIRE(compacted.getAvailable() == compacted.getCount());
+  // one track after another, in order
+  REQUIRE(compacted.getHead(0) == 0);
+  REQUIRE(compacted.getHead(1) == compacted.getTail(0) + 1);
+  REQUIRE(compacted.getHead(2) == compacted.getTail(1) + 1);
+  REQUIRE(compacted.getTail(2) == compacted.getCount() - 1);
+
+  // a pass reaching the high-water mark after edits ends there, so no
+  // node is moved into a slot the mark would still hand out
+  static Buffer<Event, 16, 2> marked;
+  for ( int32_t i{0}; i < 5; ++i )
+  {
+    marked.append(0, Event{i, Event::NoteOn, 0, 0, 0});
+    marked.append(1, Event{i + 5, Event::NoteOn, 0, 0, 0});
+  }
+  marked.compact(5);
+  for ( int i{0}; i < 3; ++i )
+    marked.remove(0);
+  for ( int32_t i{10}; i < 13; ++i )
+    marked.append(1, Event{i, Event::NoteOn, 0, 0, 0});
+  while ( !marked.compact(16) );
+  marked.append(0, Event{100, Event::NoteOn, 0, 99, 0});
+  REQUIRE(marked.getCount() == 11);
+  string expected;
+  for ( int32_t i{5}; i < 13; ++i )
+    expected += to_string(i) + ":NoteOn,C-1,0\n";
+  REQUIRE(marked.traverse(1) == expected);
+  REQUIRE(marked.traverse(0) == "3:NoteOn,C-1,0\n4:NoteOn,C-1,0\n100:NoteOn,D#7,0\n");
+}
+
+// the events a track's pointer walks from where it stands to the end
+template<class B>
+string walk(B &buffer, const uint8_t track)
+{
+  stringstream result;
+  for ( ; buffer.notUndefined(track); buffer.next(track) )
+    result << buffer.get(track);
+  return result.str();
+}
+
+TEST_CASE("Chunked storage", "[buffer]")
+{
+  // same edits on both engines, with many equal positions so the order
+  // of ties is checked too
+  static Buffer<Event, 600, 3, 8> linked;
+  static ChunkBuffer<Event, 600, 3> chunked;
+  uint32_t seed {1};
+  auto random = [&seed](const uint32_t n)
+  {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+  };
+  for ( uint16_t i{0}; i < 3000; ++i )
+  {
+    const uint8_t track = random(3);
+    const uint32_t op {random(10)};
+    if ( op < 5 && linked.getCount() < 300 )
+    {
+      const Event event {static_cast<int32_t>(random(64)), Event::NoteOn, 0,
+                         static_cast<uint8_t>(i & 0x7F), 0};
+      REQUIRE(linked.insert(track, event).forward == chunked.insert(track, event).forward);
+    }
+    else if ( op == 5 )
+    {
+      const Event event {static_cast<int32_t>(random(64)), Event::NoteOn, 0,
+                         static_cast<uint8_t>(i & 0x7F), 0};
+      linked.append(track, event);
+      chunked.append(track, event);
+    }
+    else if ( op == 6 && linked.notUndefined(track) )
+    {
+      linked.remove(track);
+      chunked.remove(track);
+    }
+    else if ( op == 7 )
+    {
+      const Event event {static_cast<int32_t>(random(70)), Event::NoteOn, 0, 0, 0};
+      linked.seek(track, event);
+      chunked.seek(track, event);
+    }
+    else if ( op == 8 && linked.notUndefined(track) )
+    {
+      linked.next(track);
+      chunked.next(track);
+    }
+    else if ( op == 9 )
+    {
+      linked.returnToZero(track);
+      chunked.returnToZero(track);
+    }
+    // compaction slices between the edits
+    if ( i % 16 == 0 )
+      chunked.compact(3);
+    REQUIRE(linked.notUndefined(track) == chunked.notUndefined(track));
+    if ( linked.notUndefined(track) )
+      REQUIRE(linked.get(track).param1 == chunked.get(track).param1);
+  }
+  REQUIRE(linked.getCount() == chunked.getCount());
+  for ( uint8_t t{0}; t < 3; ++t )
+  {
+    REQUIRE(linked.traverse(t) == chunked.traverse(t));
+    REQUIRE(walk(linked, t) == walk(chunked, t));
+  }
+
+  // data in order packs the blocks
+  chunked.clear();
+  for ( int32_t i{0}; i < 64; ++i )
+    chunked.append(1, Event{i, Event::NoteOn, 0, 60, 100});
+  REQUIRE(chunked.getBlocks(1) == 4);
+  REQUIRE(chunked.getCount() == 64);
+
+  // a compaction pass folds neighbours that fit in one block, leaving
+  // the pointer on its event
+  chunked.eraseRange(1, Event{8, Event::NoteOn, 0, 0, 0}, Event{24, Event::NoteOn, 0, 0, 0});
+  chunked.seek(1, Event{30, Event::NoteOn, 0, 0, 0});
+  const string kept {chunked.traverse(1)};
+  REQUIRE(chunked.getBlocks(1) == 4);
+  while ( !chunked.compact(2) );
+  REQUIRE(chunked.getBlocks(1) == 3);
+  REQUIRE(chunked.traverse(1) == kept);
+  REQUIRE(chunked.get(1).position == 30);
+
+  // edits in the middle leave blocks part full, so usage counts blocks
+  // and reaches 100 before the events do; inserting while it is under
+  // 100 never runs out
+  static ChunkBuffer<Event, 512, 2> edited;
+  bool full {false};
+  for ( uint16_t i{0}; i < 20000; ++i )
+  {
+    const uint8_t track = random(2);
+    const uint32_t op {random(10)};
+    if ( op < 7 && edited.getUsage() < 100 )
+      edited.insert(track, Event{static_cast<int32_t>(random(1000)), Event::NoteOn, 0, 60, 100});
+    else if ( op == 7 && edited.notUndefined(track) )
+      edited.remove(track);
+    else if ( op == 8 )
+    {
+      const int32_t from = random(1000);
+      edited.eraseRange(track, Event{from, Event::NoteOn, 0, 0, 0},
+                        Event{from + 4, Event::NoteOn, 0, 0, 0});
+    }
+    else if ( op == 9 )
+      edited.seek(track, Event{static_cast<int32_t>(random(1000)), Event::NoteOn, 0, 0, 0});
+    if ( edited.getUsage() == 100 )
+    {
+      full = true;
+      REQUIRE(edited.getCount() < 512);
+    }
+  }
+  REQUIRE(full);
+
+  // a sequence on chunked storage plays the same
+  typedef BasicSequence<int16_t, 8192, 17, ChunkBuffer> ChunkSequence;
+  static Sequence sequence;
+  static ChunkSequence chunk_sequence;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  CFile chunk_file {"midi_1.mid"};
+  MIDIFile chunk_midi_file{chunk_file};
+  chunk_midi_file.import(chunk_sequence);
+  TestMIDIPort midi_port;
+  TestMIDIPort chunk_midi_port;
+  Recorder recorder{sequence, midi_port, midi_port};
+  Player player{sequence, midi_port, recorder};
+  BasicRecorder<ChunkSequence> chunk_recorder{chunk_sequence, chunk_midi_port, chunk_midi_port};
+  BasicPlayer<ChunkSequence> chunk_player{chunk_sequence, chunk_midi_port, chunk_recorder};
+  midi_port.setTime(0);
+  chunk_midi_port.setTime(0);
+  player.play();
+  chunk_player.play();
+  player.seek(1);
+  chunk_player.seek(1);
+  for ( int i{0}; i < 480*4; i ++ )
+  {
+    player.tick();
+    chunk_player.tick();
+  }
+  REQUIRE(midi_port.getLog() != "");
+  REQUIRE(midi_port.getLog() == chunk_midi_port.getLog());
+}
+
+TEST_CASE("Erase range", "[buffer]")
+{
+  Buffer<TestNode, 8, 1> buffer;
+  for ( char c : string{"ABCDEF"} )
+    buffer.insert(0, TestNode(c));
+  buffer.seek(0, TestNode('C'));
+  // C goes, D is kept, the pointer moves on to it
+  REQUIRE(buffer.eraseRange(0, TestNode('B'), TestNode('E'),
+                            [](const TestNode &n) { return n.value == 'D'; }) == 2);
+  REQUIRE(buffer.traverse(0) == "ADEF");
+  REQUIRE(buffer.get(0).value == 'D');
+  REQUIRE(buffer.getCount() == 4);
+  string seen;
+  buffer.forEachInRange(0, TestNode('B'), TestNode('F'), [&seen](const TestNode &n) { seen += n.value; });
+  REQUIRE(seen == "DE");
+  REQUIRE(buffer.eraseRange(0, TestNode('A'), TestNode('Z')) == 4);
+  REQUIRE(buffer.traverse(0) == "");
+  REQUIRE_FALSE(buffer.notUndefined(0));
+
+  // both engines agree
+  static Buffer<Event, 500, 2, 8> linked;
+  static ChunkBuffer<Event, 500, 2> chunked;
+  uint32_t seed {3};
+  auto random = [&seed](const uint32_t n)
+  {
+    seed = seed * 1103515245 + 12345;
+    return (seed >> 16) % n;
+  };
+  auto odd = [](const Event &e) { return e.param1 & 1; };
+  for ( uint16_t i{0}; i < 600; ++i )
+  {
+    const uint8_t track = random(2);
+    if ( random(8) > 0 && linked.getCount() < 300 )
+    {
+      const Event event {static_cast<int32_t>(random(300)), Event::NoteOn, 0,
+                         static_cast<uint8_t>(i & 0x7F), 0};
+      linked.insert(track, event);
+      chunked.insert(track, event);
+      if ( random(4) == 0 )
+      {
+        linked.seek(track, event);
+        chunked.seek(track, event);
+      }
+    }
+    else
+    {
+      const int32_t from = random(300);
+      const Event start {from, Event::NoteOn, 0, 0, 0};
+      const Event end {from + static_cast<int32_t>(random(60)), Event::NoteOn, 0, 0, 0};
+      if ( random(2) )
+        REQUIRE(linked.eraseRange(track, start, end, odd) == chunked.eraseRange(track, start, end, odd));
+      else
+        REQUIRE(linked.eraseAhead(track, end, odd) == chunked.eraseAhead(track, end, odd));
+      string a, b;
+      linked.forEachInRange(track, start, end, [&a](const Event &e) { a += e.param1; });
+      chunked.forEachInRange(track, start, end, [&b](const Event &e) { b += e.param1; });
+      REQUIRE(a == b);
+    }
+    REQUIRE(linked.traverse(track) == chunked.traverse(track));
+    REQUIRE(linked.notUndefined(track) == chunked.notUndefined(track));
+    if ( linked.notUndefined(track) )
+      REQUIRE(linked.get(track).param1 == chunked.get(track).param1);
+  }
+
+  // overwriting takes out what the playhead passes and keeps new takes
+  TestMIDIPort midi_port;
+  midi_port.setTime(0);
+  Sequence sequence;
+  Track &track {sequence.getTrack(1)};
+  track.length = 4;
+  track.state = Track::OVERWRITING;
+  for ( int32_t p{0}; p < 96; p += 8 )
+    sequence.addEvent(1, Event{p, Event::NoteOn, 0, 60, 100});
+  Event take {40, Event::NoteOn, 0, 72, 100};
+  take.setNew(true);
+  sequence.addEvent(1, take);
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setRecordTrack(1);
+  recorder.setIsRecording(true);
+  recorder.setMetronome(false);
+  Player player{sequence, midi_port, recorder};
+  player.play();
+  for ( int i{0}; i < 48; i ++ )
+    player.tick();
+  string left;
+  sequence.forEachInRange(1, 0, 96, [&left](const Event &e)
+  {
+    left += to_string(e.position) + (e.isNew() ? "n " : " ");
+  });
+  REQUIRE(left == "40 48 56 64 72 80 88 ");
+  REQUIRE(sequence.getEvent(1).position == 48);
+}
+
 TEST_CASE("Event", "[event]")
 {
   REQUIRE(sizeof(Event) == 8);
@@ -410,12 +875,111 @@ TEST_CASE("Sequence Seek", "[sequence]")
   REQUIRE(result.denominator == 8);
 }
 
+TEST_CASE("Tempo Map", "[sequence]")
+{
+  Sequence sequence;
+  sequence.setTicks(480);
+  const Event slow {480*0, Event::Tempo, 0x07, 0xA1, 0x20};
+  const Event fast {480*6, Event::Tempo, 0x03, 0xD0, 0x90};
+  sequence.addEvent(0, Event{0, Event::Meter, 3, 4, 0});
+  sequence.addEvent(0, slow);
+  sequence.addEvent(0, fast);
+  sequence.addEvent(0, Event{480*9, Event::Meter, 6, 8, 0});
+  const TempoMap<TEMPO_SEGMENTS> &map {sequence.getTempoMap()};
+  REQUIRE(map.getCount() == 3);
+
+  // 3/4 throughout the slow tempo, 6/8 from measure 3
+  REQUIRE(map.getMeasurePosition(1) == 480*3);
+  REQUIRE(map.getMeasurePosition(3) == 480*9);
+  REQUIRE(map.getMeasurePosition(4) == 480*12);
+  REQUIRE(map.getMeasure(480*9 - 1) == 2);
+  REQUIRE(map.getMeasure(480*9) == 3);
+  REQUIRE(map.getMicroseconds(480*6) == 6*slow.getTempo());
+  REQUIRE(map.getMicroseconds(480*7 + 240) == 6*slow.getTempo() + 3*fast.getTempo()/2);
+  REQUIRE(map.getMeasureMicroseconds(4) == 6*slow.getTempo() + 6*fast.getTempo());
+  REQUIRE(map.getPosition(6*slow.getTempo() + 2*fast.getTempo()) == 480*8);
+  REQUIRE(map.getPosition(2*slow.getTempo()) == 480*2);
+  REQUIRE(map.getSegment(480*10).tempo == fast.getTempo());
+  REQUIRE(map.getSegment(480*10).numerator == 6);
+
+  // past the 71 minutes 32 bits of microseconds hold
+  Sequence hours;
+  hours.setTicks(24);
+  const int32_t late {24*14400};
+  hours.addEvent(0, Event{0, Event::Tempo, 0x07, 0xA1, 0x20});
+  hours.addEvent(0, Event{late, Event::Tempo, 0x03, 0xD0, 0x90});
+  const TempoMap<TEMPO_SEGMENTS> &long_map {hours.getTempoMap()};
+  const uint64_t two_hours {14400ULL*slow.getTempo()};
+  REQUIRE(long_map.getMicroseconds(late) == two_hours);
+  REQUIRE(long_map.getMicroseconds(late + 24) == two_hours + fast.getTempo());
+  REQUIRE(long_map.getPosition(two_hours + fast.getTempo()) == late + 24);
+  REQUIRE(long_map.getPosition(two_hours / 2) == late / 2);
+
+  // rebuilt once the tempo track changes
+  sequence.addEvent(0, Event{480*3, Event::Tempo, 0x0F, 0x42, 0x40});
+  REQUIRE(sequence.getTempoMap().getCount() == 4);
+  SeekResult result {sequence.seek(2)};
+  REQUIRE(result.position == 480*6);
+  REQUIRE(result.tempo == fast.getTempo());
+}
+
+TEST_CASE("FileReader", "[file]")
+{
+  uint8_t expected[256];
+  FILE *raw {fopen("midi_1.mid", "rb")};
+  REQUIRE(raw != NULL);
+  const size_t size {fread(expected, 1, sizeof(expected), raw)};
+  fclose(raw);
+  REQUIRE(size == 250);
+
+  CFile file {"midi_1.mid"};
+  FileReader<16> reader{file};
+  REQUIRE(reader.readInt(4) == 0x4D546864);
+  REQUIRE(reader.getPosition() == 4);
+  reader.skip(10);
+  REQUIRE(reader.peek() == expected[14]);
+  REQUIRE(reader.readByte() == expected[14]);
+  reader.unread();
+  REQUIRE(reader.readByte() == expected[14]);
+
+  // skipping past the block seeks the file
+  reader.skip(40);
+  REQUIRE(reader.getPosition() == 55);
+  REQUIRE(reader.readByte() == expected[55]);
+  reader.skip(-20);
+  REQUIRE(reader.readByte() == expected[36]);
+
+  uint8_t data[128];
+  REQUIRE(reader.read(100, data) == 100);
+  REQUIRE(memcmp(data, expected + 37, 100) == 0);
+  REQUIRE(reader.read(128, data) == 113);
+  REQUIRE(memcmp(data, expected + 137, 113) == 0);
+  REQUIRE(reader.getPosition() == 250);
+  file.close();
+}
+
 TEST_CASE("MIDIFile", "[midifile]")
 {
   Sequence sequence;
-  char trk0[] = "0:Tempo,599817\n"
+  // SMPTE offset, key signature and names come along as Meta events
+  char trk0[] = "0:Tempo,600000\n"
+		"0:Meter,4/4\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"1920:Tempo,750000\n"
+		"1920:Meter,3/4\n";
+  // the names of all the MTrk chunks land in front
+  char trk0_format1[] = "0:Tempo,600000\n"
 		"0:Meter,4/4\n"
-		"1920:Tempo,749835\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"0:Meta\n"
+		"1920:Tempo,750000\n"
 		"1920:Meter,3/4\n";
    char trk1[] = "0:NoteOn,C4,20\n"
 		"100:NoteOff,C4\n"
@@ -454,11 +1018,793 @@ TEST_CASE("MIDIFile", "[midifile]")
   MIDIFile midi_file1{file1};
   REQUIRE(midi_file1.import(sequence) == 0);
   REQUIRE(sequence.getTicks() == 480);
-  REQUIRE(sequence.getBuffer().traverse(0) == trk0);
+  REQUIRE(sequence.getBuffer().traverse(0) == trk0_format1);
   REQUIRE(sequence.getBuffer().traverse(1) == trk1);
   REQUIRE(sequence.getBuffer().traverse(2) == trk2);
 }
 
+// loading puts events on the same tick in front of each other, so
+// compare tracks without their order of ties
+string sortedLines(const string &text)
+{
+  vector<string> lines;
+  stringstream in {text};
+  string line;
+  while ( getline(in, line) )
+    lines.push_back(line);
+  stable_sort(lines.begin(), lines.end(), [](const string &a, const string &b)
+  {
+    return stoi(a) < stoi(b) || (stoi(a) == stoi(b) && a < b);
+  });
+  string result;
+  for ( const string &l : lines )
+    result += l + "\n";
+  return result;
+}
+
+TEST_CASE("MIDIWriter", "[midifile]")
+{
+  static Sequence sequence;
+  static Sequence loaded;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  {
+    COutFile out {"/tmp/kraang_test_save.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sequence) == 0);
+  }
+  {
+    CFile in {"/tmp/kraang_test_save.mid"};
+    MIDIFile reader{in};
+    REQUIRE(reader.import(loaded) == 0);
+  }
+  REQUIRE(loaded.getTicks() == sequence.getTicks());
+  for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+    REQUIRE(sortedLines(loaded.getBuffer().traverse(t)) ==
+            sortedLines(sequence.getBuffer().traverse(t)));
+
+  // header, tempo track and the two channels used
+  CFile saved {"/tmp/kraang_test_save.mid"};
+  uint8_t header[14];
+  REQUIRE(saved.read(14, header) == 14);
+  saved.close();
+  REQUIRE(string(reinterpret_cast<char *>(header), 4) == "MThd");
+  REQUIRE(header[9] == 1);
+  REQUIRE(header[11] == 3);
+
+  // longer than the writer's block, with running status
+  sequence.clear();
+  for ( int32_t i{0}; i < 2000; ++i )
+    sequence.appendEvent(3, Event{i * 10, i & 1 ? Event::NoteOff : Event::NoteOn, 0,
+                                  static_cast<uint8_t>(i % 100), static_cast<uint8_t>(i & 1 ? 0 : 90)});
+  sequence.appendEvent(2, Event{5, Event::ProgChange, 0, 12, 0});
+  {
+    COutFile out {"/tmp/kraang_test_save.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sequence) == 0);
+  }
+  CFile in {"/tmp/kraang_test_save.mid"};
+  MIDIFile reader{in};
+  REQUIRE(reader.import(loaded) == 0);
+  for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+    REQUIRE(sortedLines(loaded.getBuffer().traverse(t)) ==
+            sortedLines(sequence.getBuffer().traverse(t)));
+  REQUIRE(loaded.getBuffer().getCount() == 2001);
+
+  // the metronome on the tempo track stays out of the file
+  sequence.clear();
+  TestMIDIPort midi_port;
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.initMetronome();
+  sequence.appendEvent(TEMPO_TRACK, Event{0, Event::Tempo, 0x07, 0xA1, 0x20});
+  {
+    COutFile out {"/tmp/kraang_test_save.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sequence) == 0);
+  }
+  CFile clicks {"/tmp/kraang_test_save.mid"};
+  MIDIFile clicks_reader{clicks};
+  REQUIRE(clicks_reader.import(loaded) == 0);
+  REQUIRE(loaded.getBuffer().traverse(TEMPO_TRACK) == "0:Tempo,500000\n");
+}
+
+TEST_CASE("Snapshot", "[snapshot]")
+{
+  static Sequence sequence;
+  static Sequence loaded;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  sequence.getTrack(2).length = 4;
+  sequence.getTrack(2).state = Track::OFF;
+  sequence.getTrack(3).channel = 9;
+  sequence.setTicks(480);
+  {
+    COutFile out {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::save(out, sequence) == 0);
+  }
+
+  // events come back in their order, ties included
+  auto same = [&](Sequence &result)
+  {
+    REQUIRE(result.getTicks() == 480);
+    for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+    {
+      REQUIRE(result.getBuffer().traverse(t) == sequence.getBuffer().traverse(t));
+      REQUIRE(result.getTrack(t).channel == sequence.getTrack(t).channel);
+      REQUIRE(result.getTrack(t).length == sequence.getTrack(t).length);
+      REQUIRE(result.getTrack(t).state == sequence.getTrack(t).state);
+    }
+    REQUIRE(result.getBuffer().getCount() == sequence.getBuffer().getCount());
+  };
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, loaded) == 0);
+    same(loaded);
+  }
+  {
+    MMapFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, loaded) == 0);
+    same(loaded);
+  }
+  // and a slice at a time
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    SnapshotLoader<Sequence> loader{in};
+    REQUIRE(loader.begin(loaded) == 1);
+    int slices {0};
+    while ( loader.loadSlice(loaded, 7) > 0 )
+      ++ slices;
+    REQUIRE(slices >= sequence.getBuffer().getCount() / 7);
+    same(loaded);
+  }
+
+  // loaded tracks take edits like imported ones
+  loaded.addEvent(3, Event{0, Event::NoteOn, 0, 1, 2});
+  sequence.addEvent(3, Event{0, Event::NoteOn, 0, 1, 2});
+  REQUIRE(loaded.getBuffer().traverse(3) == sequence.getBuffer().traverse(3));
+  REQUIRE(loaded.getTempoMap().getMicroseconds(4800) == sequence.getTempoMap().getMicroseconds(4800));
+
+  // into chunked storage, past a block
+  typedef BasicSequence<int16_t, 8192, 17, ChunkBuffer> ChunkSequence;
+  static ChunkSequence chunked;
+  sequence.clear();
+  for ( int32_t i{0}; i < 40; ++i )
+    sequence.appendEvent(1, Event{i * 10, Event::NoteOn, 0, static_cast<uint8_t>(i), 90});
+  {
+    COutFile out {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::save(out, sequence) == 0);
+  }
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, chunked) == 0);
+  }
+  REQUIRE(chunked.getBuffer().getBlocks(1) == 3);
+  // slices top up the last block rather than start new ones
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    SnapshotLoader<ChunkSequence> loader{in};
+    REQUIRE(loader.begin(chunked) == 1);
+    while ( loader.loadSlice(chunked, 5) > 0 );
+  }
+  REQUIRE(chunked.getBuffer().getBlocks(1) == 3);
+  string events;
+  chunked.forEach(1, [&](const Event &e) { events += to_string(e.param1) + " "; });
+  REQUIRE(events.substr(0, 12) == "0 1 2 3 4 5 ");
+  REQUIRE(chunked.getBuffer().getCount() == 40);
+
+  // a changed byte fails the checksum and leaves nothing behind
+  {
+    FILE *fp {fopen("/tmp/kraang_test.krs", "r+b")};
+    fseek(fp, 12 + 17 * 8 + 4 + 5 * 8 + 5, SEEK_SET);
+    fputc(0x55, fp);
+    fclose(fp);
+  }
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, loaded) == Snapshot::CORRUPT);
+  }
+  REQUIRE(loaded.getBuffer().getCount() == 0);
+
+  // a MIDI file is not a snapshot
+  {
+    CFile in {"midi_1.mid"};
+    REQUIRE(Snapshot::load(in, loaded) == Snapshot::FORMAT_ERROR);
+  }
+  // more events than fit
+  static BasicSequence<int16_t, 16, 17> small;
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, small) == Snapshot::TOO_LARGE);
+  }
+}
+
+TEST_CASE("MIDIStream", "[midifile]")
+{
+  // a song far longer than the sequence it streams into
+  static Sequence song;
+  for ( int32_t i{0}; i < 3000; ++i )
+    song.appendEvent(3, Event{i * 5, i & 1 ? Event::NoteOff : Event::NoteOn, 0,
+                              static_cast<uint8_t>(i % 100), static_cast<uint8_t>(i & 1 ? 0 : 90)});
+  for ( int32_t i{0}; i < 200; ++i )
+    song.appendEvent(2, Event{i * 48 + 7, Event::ProgChange, 0, static_cast<uint8_t>(i % 128), 0});
+  song.appendEvent(TEMPO_TRACK, Event{0, Event::Tempo, 0x07, 0xA1, 0x20});
+  song.appendEvent(TEMPO_TRACK, Event{4800, Event::Tempo, 0x06, 0x1A, 0x80});
+  {
+    COutFile out {"/tmp/kraang_test_stream.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(song) == 0);
+  }
+
+  static Sequence whole;
+  {
+    CFile in {"/tmp/kraang_test_stream.mid"};
+    MIDIFile reader{in};
+    REQUIRE(reader.import(whole) == 0);
+  }
+  string expected;
+  {
+    TestMIDIPort midi_port;
+    midi_port.setTime(0);
+    Recorder recorder{whole, midi_port, midi_port};
+    recorder.setIsRecording(false);
+    Player player{whole, midi_port, recorder};
+    player.play();
+    for ( uint32_t tick{0}; tick < 16000; ++tick )
+      player.tick();
+    expected = midi_port.getLog() + to_string(player.getTempo());
+  }
+  REQUIRE(count(expected.begin(), expected.end(), '\n') == 3200);
+
+  for ( int mapped{0}; mapped < 2; ++mapped )
+  {
+    typedef BasicSequence<int16_t, 64, 17> Window;
+    static Window window;
+    CFile file {"/tmp/kraang_test_stream.mid"};
+    MMapFile mapped_file {"/tmp/kraang_test_stream.mid"};
+    KFile &in {mapped ? static_cast<KFile &>(mapped_file) : file};
+    MIDIStream<> stream{in};
+    REQUIRE(stream.open(window, 1) == 0);
+    int16_t most {0};
+    TestMIDIPort midi_port;
+    midi_port.setTime(0);
+    BasicRecorder<Window> recorder{window, midi_port, midi_port};
+    recorder.setIsRecording(false);
+    BasicPlayer<Window> player{window, midi_port, recorder};
+    stream.refill(window, 0);
+    player.play();
+    for ( uint32_t tick{0}; tick < 16000; ++tick )
+    {
+      stream.refill(window, player.getPosition());
+      if ( window.getBuffer().getCount() > most )
+        most = window.getBuffer().getCount();
+      player.tick();
+    }
+    REQUIRE(midi_port.getLog() + to_string(player.getTempo()) == expected);
+    REQUIRE(stream.isFinished());
+    REQUIRE(most < 64);
+  }
+
+  // with nothing dropped, as while a dump goes out, events are added
+  // behind ones already played; a track that ran dry plays them
+  static Sequence sparse;
+  for ( int32_t i{0}; i < 4; ++i )
+  {
+    sparse.appendEvent(1, Event{i * 500, Event::NoteOn, 0, 60, 90});
+    sparse.appendEvent(1, Event{i * 500 + 10, Event::NoteOff, 0, 60, 0});
+  }
+  {
+    COutFile out {"/tmp/kraang_test_sparse.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sparse) == 0);
+  }
+  {
+    typedef BasicSequence<int16_t, 64, 17> Window;
+    static Window window;
+    CFile in {"/tmp/kraang_test_sparse.mid"};
+    MIDIStream<> stream{in};
+    REQUIRE(stream.open(window, 1) == 0);
+    TestMIDIPort midi_port;
+    midi_port.setTime(0);
+    BasicRecorder<Window> recorder{window, midi_port, midi_port};
+    recorder.setIsRecording(false);
+    BasicPlayer<Window> player{window, midi_port, recorder};
+    stream.refill(window, 0);
+    player.play();
+    for ( uint32_t tick{0}; tick < 2000; ++tick )
+    {
+      while ( stream.prefetch(player.getPosition()) )
+        stream.commit(window, player.getPosition(), false);
+      player.tick();
+    }
+    const string log {midi_port.getLog()};
+    REQUIRE(count(log.begin(), log.end(), '\n') == 8);
+    REQUIRE(window.getBuffer().getCount() == 8);
+  }
+
+  CFile other {"midi_1.mid"};
+  MIDIStream<1> too_many{other};
+  static BasicSequence<int16_t, 64, 17> unused;
+  REQUIRE(too_many.open(unused) == -2);
+}
+
+class SysExMIDIPort : public TestMIDIPort
+{
+public:
+  string sysex;
+
+  void sendSysEx(const uint8_t *data, const uint16_t length)
+  {
+    sysex.append(reinterpret_cast<const char *>(data), length);
+  }
+};
+
+TEST_CASE("MIDIStream payloads", "[midifile]")
+{
+  // payloads given back out of order are reused once the older ones are
+  // back too, from the front once the end is reached
+  static Arena<64> arena;
+  const uint32_t none {Arena<64>::UNDEFINED};
+  const uint32_t a {arena.allocate(20)};
+  const uint32_t b {arena.allocate(20)};
+  const uint32_t c {arena.allocate(10)};
+  REQUIRE(arena.allocate(10) == none);
+  arena.release(b);
+  REQUIRE(arena.allocate(10) == none);
+  arena.release(a);
+  const uint32_t d {arena.allocate(30)};
+  REQUIRE(d == 0);
+  REQUIRE(arena.getUsed() == c + 12);
+  arena.release(c);
+  arena.release(d);
+  REQUIRE(arena.getUsed() == 0);
+
+  // a song with far more SysEx than the arena holds; the events share a
+  // few payloads, which the file has each time
+  static Sequence song;
+  string dumps[32];
+  for ( uint8_t i{0}; i < 32; ++i )
+  {
+    dumps[i] = string("\xF0\x43\x10", 3) + string(36, static_cast<char>(i)) + "\xF7";
+    memcpy(song.appendPayload(TEMPO_TRACK, Event{i * 50, Event::SysEx, 0, 0, 0}, 40),
+           dumps[i].data(), 40);
+  }
+  uint32_t offsets[32];
+  uint8_t n {0};
+  song.forEach(TEMPO_TRACK, [&](const Event &e) { offsets[n++] = e.getOffset(); });
+  string expected;
+  for ( int32_t i{0}; i < 300; ++i )
+  {
+    if ( i >= 32 )
+    {
+      Event event {i * 50, Event::SysEx, 0, 0, 0};
+      event.setOffset(offsets[i % 32]);
+      song.appendEvent(TEMPO_TRACK, event);
+    }
+    expected += dumps[i % 32];
+    song.appendEvent(3, Event{i * 50 + 10, Event::NoteOn, 0, 60, 90});
+  }
+  {
+    COutFile out {"/tmp/kraang_test_stream.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(song) == 0);
+  }
+  REQUIRE(expected.size() > ARENA_SIZE * 2);
+
+  typedef BasicSequence<int16_t, 64, 17> Window;
+  static Window window;
+  CFile in {"/tmp/kraang_test_stream.mid"};
+  MIDIStream<> stream{in};
+  REQUIRE(stream.open(window, 1) == 0);
+  SysExMIDIPort midi_port;
+  midi_port.setTime(0);
+  BasicRecorder<Window> recorder{window, midi_port, midi_port};
+  BasicPlayer<Window> player{window, midi_port, recorder};
+  stream.refill(window, 0);
+  player.play();
+  for ( uint32_t tick{0}; tick < 16000; ++tick )
+  {
+    stream.refill(window, player.getPosition());
+    player.tick();
+  }
+  REQUIRE(stream.isFinished());
+  REQUIRE(stream.getDropped() == 0);
+  REQUIRE(midi_port.sysex == expected);
+}
+
+TEST_CASE("SysEx arena", "[midifile]")
+{
+  static Sequence sequence;
+  const uint8_t dump[] {0xF0, 0x43, 0x10, 0x4C, 0x00, 0x00, 0x7E, 0x00, 0xF7};
+  const string expected {reinterpret_cast<const char *>(dump), sizeof(dump)};
+  uint8_t *payload {sequence.appendPayload(TEMPO_TRACK, Event{0, Event::SysEx, 0, 0, 0}, sizeof(dump))};
+  REQUIRE(payload);
+  memcpy(payload, dump, sizeof(dump));
+  payload = sequence.appendPayload(TEMPO_TRACK, Event{96, Event::Meta, 0, 0, 0}, 6);
+  memcpy(payload, "\x06Verse", 6);
+  sequence.appendEvent(1, Event{0, Event::Expression, 0, 74, 64});
+  sequence.appendEvent(1, Event{10, Event::PolyAfter, 0, 60, 30});
+  sequence.appendEvent(1, Event{20, Event::AfterTouch, 0, 50, 0});
+  REQUIRE(sequence.getArena().getUsed() == 2 + sizeof(dump) + 2 + 6);
+
+  auto payloads = [](Sequence &s)
+  {
+    string text;
+    s.forEach(TEMPO_TRACK, [&](const Event &event)
+    {
+      uint16_t length;
+      const uint8_t *data {s.getPayload(event, length)};
+      text.append(reinterpret_cast<const char *>(data), length);
+    });
+    return text;
+  };
+  const string stored {payloads(sequence)};
+  REQUIRE(stored == expected + "\x06Verse");
+
+  // the dump plays at the top, whether the metronome is on or not
+  {
+    SysExMIDIPort midi_port;
+    midi_port.setTime(0);
+    Recorder recorder{sequence, midi_port, midi_port};
+    Player player{sequence, midi_port, recorder};
+    player.play();
+    for ( int i{0}; i < 100; i ++ )
+      player.tick();
+    REQUIRE(midi_port.sysex == expected);
+    REQUIRE(midi_port.getLog() == "0:0:0:176,74,64\n0:0:10:160,60,30\n0:0:20:208,50,0\n");
+  }
+
+  // saved and read back whole
+  static Sequence loaded;
+  {
+    COutFile out {"/tmp/kraang_test_sysex.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sequence) == 0);
+  }
+  {
+    CFile in {"/tmp/kraang_test_sysex.mid"};
+    MIDIFile reader{in};
+    REQUIRE(reader.import(loaded) == 0);
+  }
+  REQUIRE(payloads(loaded) == stored);
+  REQUIRE(loaded.getBuffer().traverse(1) == sequence.getBuffer().traverse(1));
+  {
+    COutFile out {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::save(out, sequence) == 0);
+  }
+  {
+    CFile in {"/tmp/kraang_test.krs"};
+    REQUIRE(Snapshot::load(in, loaded) == 0);
+  }
+  REQUIRE(payloads(loaded) == stored);
+
+  // clearing gives the whole arena back at once
+  sequence.clear();
+  REQUIRE(sequence.getArena().getUsed() == 0);
+  while ( sequence.appendPayload(TEMPO_TRACK, Event{0, Event::SysEx, 0, 0, 0}, 1000) );
+  REQUIRE(sequence.getArena().getUsed() > ARENA_SIZE - 1002);
+  REQUIRE(sequence.getBuffer().getCount() == ARENA_SIZE / 1002);
+
+  // a serial line takes the dump as far as there is room, and the next
+  // message repeats its status
+  MIDIOutQueue<8> queue;
+  REQUIRE(queue.push(0, Event{0, Event::NoteOn, 0, 60, 100}));
+  REQUIRE(queue.pushBytes(dump, sizeof(dump)) == 5);
+  while ( !queue.isEmpty() )
+    queue.pop();
+  REQUIRE(queue.pushBytes(dump + 5, sizeof(dump) - 5) == 4);
+  REQUIRE(queue.push(0, Event{0, Event::NoteOn, 0, 62, 100}));
+  REQUIRE(queue.getCount() == 7);
+}
+
+template<class S>
+string sysExOrder(S &sequence)
+{
+  const uint8_t first[] {0xF0, 0x7E, 0x01, 0xF7};
+  const uint8_t second[] {0xF0, 0x7E, 0x02, 0xF7};
+  sequence.appendEvent(TEMPO_TRACK, Event{0, Event::Tempo, 0, 0, 0});
+  memcpy(sequence.appendPayload(TEMPO_TRACK, Event{0, Event::SysEx, 0, 0, 0}, 4), first, 4);
+  memcpy(sequence.appendPayload(TEMPO_TRACK, Event{0, Event::SysEx, 0, 0, 0}, 4), second, 4);
+  string ids;
+  sequence.forEach(TEMPO_TRACK, [&](const Event &event)
+  {
+    uint16_t length;
+    if ( event.getType() == Event::SysEx )
+      ids += '0' + sequence.getPayload(event, length)[2];
+  });
+  return ids;
+}
+
+TEST_CASE("SysEx order", "[midifile]")
+{
+  // dumps on one tick go out in the order the file has them
+  static Sequence sequence;
+  REQUIRE(sysExOrder(sequence) == "12");
+  typedef BasicSequence<int16_t, 8192, 17, ChunkBuffer> ChunkSequence;
+  static ChunkSequence chunked;
+  REQUIRE(sysExOrder(chunked) == "12");
+
+  SysExMIDIPort midi_port;
+  Recorder recorder{sequence, midi_port, midi_port};
+  Player player{sequence, midi_port, recorder};
+  player.play();
+  player.tick();
+  REQUIRE(midi_port.sysex == string("\xF0\x7E\x01\xF7\xF0\x7E\x02\xF7", 8));
+
+  {
+    COutFile out {"/tmp/kraang_test_order.mid"};
+    MIDIWriter writer{out};
+    REQUIRE(writer.save(sequence) == 0);
+  }
+  static Sequence loaded;
+  CFile in {"/tmp/kraang_test_order.mid"};
+  MIDIFile reader{in};
+  REQUIRE(reader.import(loaded) == 0);
+  REQUIRE(loaded.getBuffer().traverse(TEMPO_TRACK) == sequence.getBuffer().traverse(TEMPO_TRACK));
+}
+
+TEST_CASE("MIDIFile mapped", "[midifile]")
+{
+  const char *paths[] = {"midi_0.mid", "midi_1.mid"};
+  for ( const char *path : paths )
+  {
+    Sequence expected;
+    CFile file {path};
+    MIDIFile midi_file{file};
+    REQUIRE(midi_file.import(expected) == 0);
+
+    Sequence sequence;
+    MMapFile mapped {path};
+    REQUIRE(mapped.isValid());
+    REQUIRE(mapped.getSize() == (path[5] == '0' ? 199 : 250));
+    MIDIFile mapped_file{mapped};
+    REQUIRE(mapped_file.import(sequence) == 0);
+    REQUIRE(sequence.getTicks() == expected.getTicks());
+    for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+      REQUIRE(sequence.getBuffer().traverse(t) == expected.getBuffer().traverse(t));
+  }
+}
+
+TEST_CASE("MIDIFile parallel", "[midifile]")
+{
+  const char *paths[] = {"midi_0.mid", "midi_1.mid"};
+  for ( const char *path : paths )
+  {
+    Sequence expected;
+    CFile file {path};
+    MIDIFile midi_file{file};
+    REQUIRE(midi_file.import(expected) == 0);
+
+    for ( unsigned threads {1}; threads <= 4; threads *= 2 )
+    {
+      Sequence sequence;
+      MMapFile mapped {path};
+      ParallelMIDIFile mapped_file{mapped, threads};
+      REQUIRE(mapped_file.import(sequence) == 0);
+      REQUIRE(sequence.getTicks() == expected.getTicks());
+      for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+        REQUIRE(sequence.getBuffer().traverse(t) == expected.getBuffer().traverse(t));
+
+      Sequence copied;
+      CFile unmapped {path};
+      ParallelMIDIFile unmapped_file{unmapped, threads};
+      REQUIRE(unmapped_file.import(copied) == 0);
+      for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+        REQUIRE(copied.getBuffer().traverse(t) == expected.getBuffer().traverse(t));
+    }
+  }
+
+  // chunks cut short, or claiming far more than the file holds, end with
+  // it instead of reading past the mapping
+  uint8_t song[256];
+  FILE *raw {fopen("midi_1.mid", "rb")};
+  REQUIRE(raw != NULL);
+  const size_t size {fread(song, 1, sizeof(song), raw)};
+  fclose(raw);
+  // the last MTrk, whose length is set to wrap past the end of the file
+  size_t last {size - 4};
+  while ( last > 0 && memcmp(song + last, "MTrk", 4) != 0 )
+    -- last;
+  REQUIRE(last > 0);
+  Sequence intact;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  REQUIRE(midi_file.import(intact) == 0);
+  for ( int oversized{0}; oversized < 2; ++oversized )
+  {
+    {
+      FILE *fp {fopen("/tmp/kraang_test_damaged.mid", "wb")};
+      if ( oversized )
+      {
+        fwrite(song, 1, last + 4, fp);
+        fwrite("\xFF\xFF\xFF\xF0", 1, 4, fp);
+        fwrite(song + last + 8, 1, size - last - 8, fp);
+      }
+      else
+        fwrite(song, 1, size - 20, fp);
+      fclose(fp);
+    }
+    Sequence sequence;
+    MMapFile mapped {"/tmp/kraang_test_damaged.mid"};
+    ParallelMIDIFile mapped_file{mapped, 2};
+    REQUIRE(mapped_file.import(sequence) == 0);
+    REQUIRE(sequence.getBuffer().traverse(TEMPO_TRACK) == intact.getBuffer().traverse(TEMPO_TRACK));
+    // the last chunk runs to the end of the file, where it ends anyway
+    if ( oversized )
+      for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+        REQUIRE(sequence.getBuffer().traverse(t) == intact.getBuffer().traverse(t));
+  }
+}
+
+// logs how many events each driver write would carry
+class BatchMIDIPort : public MIDIPort
+{
+private:
+  stringstream log;
+  int pending;
+  bool batching;
+public:
+  BatchMIDIPort() : pending{0}, batching{false}
+  {
+  }
+
+  void beginTick()
+  {
+    batching = true;
+  }
+
+  void send(const uint8_t channel, const Event &event)
+  {
+    pending ++;
+    if ( !batching )
+      flush();
+  }
+
+  void flush()
+  {
+    if ( pending )
+      log << pending << "\n";
+    pending = 0;
+    batching = false;
+  }
+
+  string getLog() const
+  {
+    return log.str();
+  }
+};
+
+TEST_CASE("Player batches", "[player]")
+{
+  Sequence sequence;
+  BatchMIDIPort midi_port;
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setIsRecording(false);
+  Player player{sequence, midi_port, recorder};
+  for ( uint8_t t{1}; t <= 3; ++t )
+    sequence.addEvent(t, Event{0, Event::NoteOn, 0, static_cast<uint8_t>(59 + t), 100});
+  sequence.addEvent(1, Event{10, Event::NoteOff, 0, 60, 0});
+  sequence.addEvent(2, Event{12, Event::NoteOff, 0, 61, 0});
+  sequence.addEvent(3, Event{12, Event::NoteOff, 0, 62, 0});
+  sequence.addEvent(1, Event{20, Event::NoteOn, 0, 70, 100});
+  sequence.addEvent(3, Event{20, Event::NoteOn, 0, 72, 100});
+  player.play();
+  for ( int i{0}; i < 24; i ++ )
+    player.tick();
+  REQUIRE(midi_port.getLog() == "3\n1\n2\n2\n");
+
+  // passthru outside a tick is not held back
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 64, 100});
+  REQUIRE(midi_port.getLog() == "3\n1\n2\n2\n1\n");
+  player.stop();
+  REQUIRE(midi_port.getLog() == "3\n1\n2\n2\n1\n2\n");
+}
+
+string drain(MIDIOutQueue<16> &queue)
+{
+  stringstream bytes;
+  while ( !queue.isEmpty() )
+    bytes << hex << static_cast<int>(queue.pop()) << " ";
+  return bytes.str();
+}
+
+class QueuedMIDIPort : public MIDIPort
+{
+public:
+  MIDIOutQueue<16> queue;
+
+  void send(const uint8_t channel, const Event &event)
+  {
+    queue.push(channel, event);
+  }
+
+  uint32_t getBacklog() const
+  {
+    return queue.getBacklog();
+  }
+};
+
+TEST_CASE("MIDIOutQueue", "[midiport]")
+{
+  MIDIOutQueue<16> queue;
+  REQUIRE(queue.push(0, Event{0, Event::NoteOn, 0, 60, 100}));
+  REQUIRE(queue.push(0, Event{0, Event::NoteOn, 0, 64, 100}));
+  REQUIRE(queue.push(0, Event{0, Event::NoteOn, 0, 67, 100}));
+  REQUIRE(queue.getCount() == 7);
+  REQUIRE(queue.getBacklog() == 7*320);
+  REQUIRE(drain(queue) == "90 3c 64 40 64 43 64 ");
+
+  // new status, two byte messages, and running status carried on
+  REQUIRE(queue.push(1, Event{0, Event::NoteOn, 0, 60, 100}));
+  REQUIRE(queue.push(1, Event{0, Event::ProgChange, 0, 5, 0}));
+  REQUIRE(queue.push(1, Event{0, Event::ProgChange, 0, 6, 0}));
+  REQUIRE(queue.push(1, Event{0, Event::NoteOff, 0, 60, 0}));
+  REQUIRE(drain(queue) == "91 3c 64 c1 5 6 81 3c 0 ");
+  queue.clearRunningStatus();
+  REQUIRE(queue.push(1, Event{0, Event::NoteOff, 0, 61, 0}));
+  REQUIRE(drain(queue) == "81 3d 0 ");
+
+  // full queue drops whole messages and keeps running status intact
+  for ( uint8_t i{0}; i < 7; ++i )
+    REQUIRE(queue.push(2, Event{0, Event::NoteOn, 0, i, 1}));
+  REQUIRE(queue.getCount() == 15);
+  REQUIRE_FALSE(queue.push(2, Event{0, Event::NoteOn, 0, 7, 1}));
+  REQUIRE(queue.getDropped() == 1);
+  queue.pop();
+  queue.pop();
+  REQUIRE(queue.push(2, Event{0, Event::NoteOn, 0, 7, 1}));
+  REQUIRE(queue.getCount() == 15);
+
+  // at 480 ticks and 120 bpm a tick lasts 1042us, about 3 bytes
+  Sequence sequence;
+  sequence.setTicks(480);
+  QueuedMIDIPort midi_port;
+  Recorder recorder{sequence, midi_port, midi_port};
+  Player player{sequence, midi_port, recorder};
+  REQUIRE_FALSE(player.isOutputBehind());
+  midi_port.queue.push(0, Event{0, Event::NoteOn, 0, 60, 100});
+  REQUIRE_FALSE(player.isOutputBehind());
+  midi_port.queue.push(0, Event{0, Event::NoteOn, 0, 62, 100});
+  REQUIRE(player.isOutputBehind());
+}
+
+TEST_CASE("Sequence sizes", "[sequence]")
+{
+  // byte links and two channels for a small board
+  typedef BasicSequence<int8_t, 100, 3> SmallSequence;
+  SmallSequence small;
+  REQUIRE(sizeof(SmallSequence) < sizeof(Sequence) / 10);
+  TestMIDIPort midi_port;
+  TestTiming timing;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  REQUIRE(midi_file.import(small) == 0);
+  BasicRecorder<SmallSequence> recorder{small, midi_port, midi_port};
+  BasicPlayer<SmallSequence> player{small, midi_port, recorder};
+  player.play();
+  for ( int i{0}; i < 480*2; i ++ )
+  {
+    midi_port.setTime(timing.getMicroseconds());
+    player.tick();
+    timing.delay(player.getDelay());
+  }
+  const string start {"0:0:0:NoteOn,C4,20\n"
+                     "125000:0:100:NoteOff,C4\n"
+                     "150000:1:120:NoteOn,C#3,60\n"};
+  REQUIRE(midi_port.getLog().substr(0, start.size()) == start);
+
+  // past what 16 bit links can address
+  typedef BasicSequence<int32_t, 100000, 2> BigSequence;
+  static BigSequence big;
+  for ( int32_t i{0}; i < 40000; ++i )
+    big.appendEvent(1, Event{i * 4, Event::NoteOn, 0, 60, 100});
+  REQUIRE(big.getBuffer().getCount() == 40000);
+  REQUIRE(big.getUsage() == 40);
+  big.seek(1000);
+  REQUIRE(big.getEvent(1).position == 96000);
+}
+
 TEST_CASE("Player Count", "[player]")
 {
   Sequence sequence;
@@ -526,11 +1872,11 @@ TEST_CASE("Player Play", "[player]")
 		  "1050000:1:840:NoteOn,G3,90\n"
 		  "1175000:1:940:NoteOff,G3\n"
 		  "2400000:0:1920:NoteOn,C4,100\n"
-		  "2774880:0:2160:NoteOff,C4\n"
-		  "3149760:0:2400:NoteOn,C#4,100\n"
-		  "3524640:0:2640:NoteOff,C#4\n"
-		  "3899520:0:2880:NoteOn,D4,100\n"
-		  "4274400:0:3120:NoteOff,D4\n";
+		  "2775120:0:2160:NoteOff,C4\n"
+		  "3150240:0:2400:NoteOn,C#4,100\n"
+		  "3525360:0:2640:NoteOff,C#4\n"
+		  "3900480:0:2880:NoteOn,D4,100\n"
+		  "4275600:0:3120:NoteOff,D4\n";
   REQUIRE(midi_port.getLog() == result);
 
   midi_port.clear();
@@ -547,12 +1893,12 @@ TEST_CASE("Player Play", "[player]")
     timing.delay(player.getDelay());
   }
 
-  char seekrs[] = "4649280:0:1920:NoteOn,C4,100\n"
-		  "5024160:0:2160:NoteOff,C4\n"
-		  "5399040:0:2400:NoteOn,C#4,100\n"
-		  "5773920:0:2640:NoteOff,C#4\n"
-		  "6148800:0:2880:NoteOn,D4,100\n"
-		  "6523680:0:3120:NoteOff,D4\n";
+  char seekrs[] = "4650720:0:1920:NoteOn,C4,100\n"
+		  "5025840:0:2160:NoteOff,C4\n"
+		  "5400960:0:2400:NoteOn,C#4,100\n"
+		  "5776080:0:2640:NoteOff,C#4\n"
+		  "6151200:0:2880:NoteOn,D4,100\n"
+		  "6526320:0:3120:NoteOff,D4\n";
   REQUIRE(midi_port.getLog() == seekrs); 
 }
 
@@ -576,10 +1922,12 @@ TEST_CASE("Player loop", "[player]")
 		  "600000:0:24:NoteOn,C4,40\n"
 		  "1200000:0:48:NoteOn,C4,50\n"
 		  "1800000:0:72:NoteOn,C4,60\n"
+		  "2375000:0:0:NoteOff,C4\n"
 		  "2400000:0:0:NoteOn,C4,30\n"
 		  "3000000:0:24:NoteOn,C4,40\n"
 		  "3600000:0:48:NoteOn,C4,50\n"
 		  "4200000:0:72:NoteOn,C4,60\n"
+		  "4775000:0:0:NoteOff,C4\n"
 		  "4800000:0:0:NoteOn,C4,30\n";
   for ( int i{0}; i < 24*9; i ++ )
   {
@@ -591,6 +1939,186 @@ TEST_CASE("Player loop", "[player]")
   REQUIRE(midi_port.getLog() == result);
 }
 
+// plays like the host loops do: wake up only when a tick has work
+int advanceFor(const uint32_t ticks, TestMIDIPort &midi_port, TestTiming &timing, Player &player)
+{
+  int wakeups {0};
+  uint32_t next {1};
+  while ( player.getPosition() < ticks )
+  {
+    midi_port.setTime(timing.getMicroseconds());
+    player.advanceTo(min(player.getPosition() + next, ticks));
+    next = player.getIdleTicks() + 1;
+    timing.delay(next * player.getDelay());
+    wakeups ++;
+  }
+  return wakeups;
+}
+
+TEST_CASE("Player advance", "[player]")
+{
+  Sequence sequence;
+  TestMIDIPort midi_port;
+  TestTiming timing;
+
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setIsRecording(false);
+  Player player{sequence, midi_port, recorder};
+  player.play();
+  REQUIRE(player.getIdleTicks() == 0);
+  const int wakeups {advanceFor(480*7, midi_port, timing, player)};
+  REQUIRE(player.getPosition() == 480*7);
+  REQUIRE(wakeups < 480*7/10);
+  char result[] = "0:0:0:NoteOn,C4,20\n"
+		  "125000:0:100:NoteOff,C4\n"
+		  "150000:1:120:NoteOn,C#3,60\n"
+		  "275000:1:220:NoteOff,C#3\n"
+		  "300000:0:240:NoteOn,D4,30\n"
+		  "425000:0:340:NoteOff,D4\n"
+		  "450000:1:360:NoteOn,D#3,70\n"
+		  "575000:1:460:NoteOff,D#3\n"
+		  "600000:0:480:NoteOn,E4,40\n"
+		  "725000:0:580:NoteOff,E4\n"
+		  "750000:1:600:NoteOn,F3,80\n"
+		  "875000:1:700:NoteOff,F3\n"
+		  "900000:0:720:NoteOn,F#4,50\n"
+		  "1025000:0:820:NoteOff,F#4\n"
+		  "1050000:1:840:NoteOn,G3,90\n"
+		  "1175000:1:940:NoteOff,G3\n"
+		  "2400000:0:1920:NoteOn,C4,100\n"
+		  "2775120:0:2160:NoteOff,C4\n"
+		  "3150240:0:2400:NoteOn,C#4,100\n"
+		  "3525360:0:2640:NoteOff,C#4\n"
+		  "3900480:0:2880:NoteOn,D4,100\n"
+		  "4275600:0:3120:NoteOff,D4\n";
+  REQUIRE(midi_port.getLog() == result);
+  REQUIRE(player.getMeasure() == 2);
+
+  // loops wrap on time
+  Sequence loop;
+  TestMIDIPort loop_port;
+  Recorder loop_recorder{loop, loop_port, loop_port};
+  loop_recorder.setIsRecording(false);
+  Player loop_player{loop, loop_port, loop_recorder};
+  loop_player.setTempo(600000);
+  loop.getTrack(1).length = 4;
+  loop.addEvent(1, Event{24*0 + 5, Event::NoteOn, 0, 60, 30});
+  loop.addEvent(1, Event{24*2 + 7, Event::NoteOn, 0, 60, 50});
+  loop_player.play();
+  TestTiming loop_timing;
+  advanceFor(24*9, loop_port, loop_timing, loop_player);
+  REQUIRE(loop_port.getLog() == "125000:0:5:NoteOn,C4,30\n"
+                                "1375000:0:55:NoteOn,C4,50\n"
+                                "2375000:0:0:NoteOff,C4\n"
+                                "2525000:0:5:NoteOn,C4,30\n"
+                                "3775000:0:55:NoteOn,C4,50\n"
+                                "4775000:0:0:NoteOff,C4\n"
+                                "4925000:0:5:NoteOn,C4,30\n");
+}
+
+TEST_CASE("Player idle while armed", "[player]")
+{
+  // a default recorder is armed on track 1; that alone keeps no tick busy
+  Sequence sequence;
+  TestMIDIPort midi_port;
+  TestTiming timing;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  Recorder recorder{sequence, midi_port, midi_port};
+  Player player{sequence, midi_port, recorder};
+  player.play();
+  REQUIRE(recorder.isRecordState(1, sequence.getTrack(1)));
+  REQUIRE(advanceFor(480*7, midi_port, timing, player) < 480*7/10);
+
+  // until input is waiting to be recorded
+  REQUIRE(player.getIdleTicks() > 0);
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 60, 100}, timing.getMicroseconds());
+  REQUIRE_FALSE(recorder.isIdle());
+  REQUIRE(player.getIdleTicks() == 0);
+  player.tick();
+  REQUIRE(recorder.isIdle());
+}
+
+TEST_CASE("Renderer", "[player]")
+{
+  Sequence sequence;
+  CFile file {"midi_1.mid"};
+  MIDIFile midi_file{file};
+  midi_file.import(sequence);
+  stringstream log;
+  auto sink = [&log](const RenderedEvent &r)
+  {
+    log << r.time << ":" << static_cast<int>(r.channel) << ":" << r.event;
+  };
+  BasicRenderer<Sequence, decltype(sink)> renderer{sequence, sink};
+  REQUIRE(renderer.render() == 22);
+  // exact tick times, tempo change included, rather than rounded delays
+  const string start {"0:0:0:NoteOn,C4,20\n"
+                      "125000:0:100:NoteOff,C4\n"
+                      "150000:1:120:NoteOn,C#3,60\n"};
+  REQUIRE(log.str().substr(0, start.size()) == start);
+  const string end {"3900000:0:2880:NoteOn,D4,100\n"
+                    "4275000:0:3120:NoteOff,D4\n"};
+  REQUIRE(log.str().substr(log.str().size() - end.size()) == end);
+  REQUIRE(renderer.getLength() == 4275000);
+
+  // again from the top, stopping early
+  log.str("");
+  REQUIRE(renderer.render(1000) == 16);
+  REQUIRE(log.str().substr(0, start.size()) == start);
+
+  // a song with no tempo at its start begins at 120 bpm every time, not
+  // in the tempo the last render ended on
+  Sequence untimed;
+  untimed.setTicks(24);
+  untimed.addEvent(1, Event{0, Event::NoteOn, 0, 60, 90});
+  untimed.addEvent(1, Event{48, Event::NoteOff, 0, 60, 0});
+  untimed.addEvent(TEMPO_TRACK, Event{24, Event::Tempo, 0x0F, 0x42, 0x40});
+  BasicRenderer<Sequence, decltype(sink)> again{untimed, sink};
+  for ( int i{0}; i < 2; ++i )
+  {
+    log.str("");
+    REQUIRE(again.render() == 2);
+    REQUIRE(again.getLength() == 1500000);
+  }
+}
+
+TEST_CASE("Clock", "[clock]")
+{
+  TestTiming timing;
+  Clock<TestTiming> clock{timing};
+
+  // 1041.67us a tick at 480 ticks and 120 bpm adds up exactly
+  for ( int i{0}; i < 480; i ++ )
+  {
+    clock.advance(1, 500000, 480);
+    clock.wait();
+    REQUIRE(clock.getLateness() == 0);
+  }
+  REQUIRE(timing.getMicroseconds() == 500000);
+  clock.advance(480*3, 500000, 480);
+  REQUIRE(clock.getDeadline() == 2000000);
+
+  // a late wake-up is reported and the following ticks catch up
+  clock.wait();
+  timing.delay(3000);
+  clock.advance(1, 500000, 480);
+  clock.wait();
+  REQUIRE(clock.getLateness() == 1959);
+  clock.advance(1, 500000, 480);
+  clock.wait();
+  REQUIRE(clock.getLateness() == 917);
+  clock.advance(1, 500000, 480);
+  clock.wait();
+  REQUIRE(clock.getLateness() == 0);
+  REQUIRE(clock.getMaxLateness() == 1959);
+  REQUIRE(timing.getMicroseconds() == 2003125);
+}
+
 void playFor(const int ticks, TestMIDIPort &midi_port, TestTiming &timing, Player &player)
 {
 	for ( int i = 0; i < ticks; i ++ )
@@ -631,6 +2159,321 @@ TEST_CASE("Recorder passthru", "[recorder]")
 	REQUIRE(midi_port.getLog() == result);
 }
 
+TEST_CASE("Recorder input queue", "[recorder]")
+{
+  // one producer and one consumer thread see every item in order
+  SPSCQueue<uint32_t, 16> queue;
+  thread producer([&queue]()
+  {
+    for ( uint32_t i{0}; i < 10000; )
+      if ( queue.push(i) )
+        i ++;
+      else
+        this_thread::yield();
+  });
+  uint32_t expected {0};
+  bool ordered {true};
+  while ( expected < 10000 )
+    if ( !queue.drain([&](const uint32_t item)
+    {
+      ordered = item == expected++ && ordered;
+    }) )
+      this_thread::yield();
+  producer.join();
+  REQUIRE(ordered);
+  REQUIRE(queue.isEmpty());
+
+  // a chord bigger than the old 8 event limit lands between two ticks
+  TestMIDIPort midi_port;
+  TestTiming timing;
+  Sequence sequence;
+  Track &track {sequence.getTrack(1)};
+  track.length = 4;
+  track.state = Track::OVERDUBBING;
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setRecordTrack(1);
+  recorder.setIsRecording(true);
+  Player player{sequence, midi_port, recorder};
+  player.play();
+  playFor(24, midi_port, timing, player);
+  for ( uint8_t i{0}; i < 12; ++i )
+    recorder.receiveEvent(Event{0, Event::NoteOn, 0, static_cast<uint8_t>(48 + i), 100});
+  REQUIRE_FALSE(recorder.isIdle());
+  playFor(1, midi_port, timing, player);
+  int count {0};
+  sequence.getBuffer().forEach(1, [&count](const Event &event)
+  {
+    count += event.position == 24;
+  });
+  REQUIRE(count == 12);
+  REQUIRE(recorder.getInputOverflows() == 0);
+
+  // beyond capacity input is counted and dropped, never aborts
+  for ( uint8_t i{0}; i < 70; ++i )
+    recorder.receiveEvent(Event{0, Event::NoteOff, 0, 60, 0});
+  REQUIRE(recorder.getInputOverflows() == 7);
+  playFor(1, midi_port, timing, player);
+  count = 0;
+  sequence.getBuffer().forEach(1, [&count](const Event &event)
+  {
+    count ++;
+  });
+  REQUIRE(count == 12 + 63);
+}
+
+TEST_CASE("Player releases notes", "[player]")
+{
+  NoteTracker<2> tracker;
+  tracker.update(0, Event{0, Event::NoteOn, 0, 0, 100});
+  tracker.update(0, Event{0, Event::NoteOn, 0, 127, 100});
+  tracker.update(0, Event{0, Event::NoteOn, 0, 60, 100});
+  tracker.update(0, Event{0, Event::NoteOn, 0, 60, 0});
+  tracker.update(1, Event{0, Event::NoteOn, 0, 61, 100});
+  REQUIRE(tracker.isSounding(0, 127));
+  REQUIRE_FALSE(tracker.isSounding(0, 60));
+  stringstream released;
+  tracker.release(0, [&released](const Event &event) { released << event; });
+  REQUIRE(released.str() == "0:NoteOff,C-1\n0:NoteOff,G9\n");
+  REQUIRE_FALSE(tracker.isSounding(0));
+  REQUIRE(tracker.isSounding(1));
+  tracker.update(1, Event::allNotesOff());
+  REQUIRE_FALSE(tracker.isSounding(1));
+
+  Sequence sequence;
+  TestMIDIPort midi_port;
+  midi_port.setTime(0);
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setIsRecording(false);
+  Player player{sequence, midi_port, recorder};
+  sequence.getTrack(1).channel = 3;
+  sequence.getTrack(2).channel = 3;
+  sequence.addEvent(1, Event{0, Event::NoteOn, 0, 60, 100});
+  sequence.addEvent(2, Event{0, Event::NoteOn, 0, 64, 100});
+  sequence.addEvent(2, Event{10, Event::NoteOff, 0, 64, 0});
+  sequence.addEvent(2, Event{15, Event::NoteOn, 0, 65, 100});
+  sequence.addEvent(2, Event{96*2, Event::NoteOn, 0, 67, 100});
+  player.play();
+  for ( int i{0}; i < 20; i ++ )
+    player.tick();
+
+  // a track turning off releases only its own notes at the measure
+  midi_port.clear();
+  sequence.getTrack(2).state = Track::TURNING_OFF;
+  for ( int i{0}; i < 96; i ++ )
+    player.tick();
+  REQUIRE(midi_port.getLog() == "0:3:0:NoteOff,F4\n");
+
+  // stop sends exactly what is left sounding
+  midi_port.clear();
+  player.stop();
+  REQUIRE(midi_port.getLog() == "0:3:0:NoteOff,C4\n");
+  midi_port.clear();
+  player.stop();
+  REQUIRE(midi_port.getLog() == "");
+}
+
+TEST_CASE("Player queue", "[player]")
+{
+  static Sequence current;
+  static Sequence next;
+  TestMIDIPort midi_port;
+  midi_port.setTime(0);
+  Recorder recorder{current, midi_port, midi_port};
+  recorder.setIsRecording(false);
+  Player player{current, midi_port, recorder};
+  current.getTrack(1).channel = 3;
+  current.addEvent(1, Event{0, Event::NoteOn, 0, 60, 100});
+  next.getTrack(2).channel = 5;
+  next.addEvent(2, Event{0, Event::NoteOn, 0, 64, 100});
+  next.addEvent(2, Event{10, Event::NoteOff, 0, 64, 0});
+  player.play();
+  for ( int i{0}; i < 40; i ++ )
+    player.tick();
+
+  // advancing stops where the position starts over
+  player.queue(next);
+  REQUIRE(player.advanceTo(1000));
+  REQUIRE(&player.getSequence() == &next);
+  REQUIRE(player.getPosition() == 0);
+  player.queue(current);
+  player.advanceTo(1000);
+  REQUIRE(player.getPosition() == 0);
+  for ( int i{0}; i < 40; i ++ )
+    player.tick();
+
+  // the current song plays out its measure, then the next one starts
+  player.queue(next);
+  REQUIRE(player.isQueued());
+  midi_port.clear();
+  for ( int i{0}; i < 55; i ++ )
+    player.tick();
+  REQUIRE(midi_port.getLog() == "");
+  REQUIRE(&player.getSequence() == &current);
+  player.tick();
+  REQUIRE(midi_port.getLog() == "0:3:0:NoteOff,C4\n");
+  REQUIRE(&player.getSequence() == &next);
+  REQUIRE_FALSE(player.isQueued());
+  REQUIRE(player.getPosition() == 0);
+  REQUIRE(player.getMeasure() == 0);
+  midi_port.clear();
+  for ( int i{0}; i < 11; i ++ )
+    player.tick();
+  REQUIRE(midi_port.getLog() == "0:5:0:NoteOn,E4,100\n0:5:10:NoteOff,E4\n");
+
+  // a cancelled queue never switches
+  player.queue(current);
+  player.unqueue();
+  REQUIRE_FALSE(player.isQueued());
+  for ( int i{0}; i < 100; i ++ )
+    player.tick();
+  REQUIRE(&player.getSequence() == &next);
+
+  // a song read in slices matches one read at once
+  CFile whole_file {"midi_1.mid"};
+  MIDIFile whole{whole_file};
+  REQUIRE(whole.import(current) == 0);
+  CFile sliced_file {"midi_1.mid"};
+  MIDIFile sliced{sliced_file};
+  sliced.beginImport(next);
+  int slices {0};
+  int8_t result;
+  while ( (result = sliced.importSlice(next, 4)) > 0 )
+    ++ slices;
+  REQUIRE(result == 0);
+  REQUIRE(slices > 5);
+  REQUIRE(next.getTicks() == current.getTicks());
+  for ( uint8_t t{0}; t < Sequence::TRACKS; ++t )
+    REQUIRE(next.getBuffer().traverse(t) == current.getBuffer().traverse(t));
+}
+
+TEST_CASE("Player chase", "[player]")
+{
+  Sequence sequence;
+  TestMIDIPort midi_port;
+  midi_port.setTime(0);
+  Recorder recorder{sequence, midi_port, midi_port};
+  Player player{sequence, midi_port, recorder};
+  // 96 ticks a measure
+  sequence.addEvent(1, Event{0, Event::ProgChange, 0, 5, 0});
+  sequence.addEvent(1, Event{10, Event::Expression, 0, 7, 100});
+  sequence.addEvent(1, Event{96*2, Event::PitchBend, 0, 0, 80});
+  sequence.addEvent(1, Event{96*6, Event::Expression, 0, 7, 80});
+  sequence.addEvent(1, Event{96*9 - 1, Event::Expression, 0, 10, 20});
+  sequence.addEvent(1, Event{96*9, Event::Expression, 0, 64, 127});
+  sequence.addEvent(1, Event{96*9, Event::NoteOn, 0, 60, 100});
+  sequence.addEvent(2, Event{96*3, Event::ProgChange, 0, 9, 0});
+  sequence.addEvent(3, Event{96*20, Event::NoteOn, 0, 60, 100});
+  // the bank is selected ahead of the program, expression is chased too
+  sequence.addEvent(4, Event{0, Event::Expression, 0, 0, 1});
+  sequence.addEvent(4, Event{0, Event::Expression, 0, 32, 2});
+  sequence.addEvent(4, Event{96, Event::ProgChange, 0, 40, 0});
+  sequence.addEvent(4, Event{96*2, Event::Expression, 0, 11, 90});
+  sequence.addEvent(4, Event{96*2, Event::Expression, 0, 91, 30});
+
+  player.seek(9);
+  REQUIRE(midi_port.getLog() == "0:0:0:192,5,0\n"
+                                "0:0:0:176,7,80\n"
+                                "0:0:0:176,10,20\n"
+                                "0:0:0:224,0,80\n"
+                                "0:1:0:192,9,0\n"
+                                "0:3:0:176,0,1\n"
+                                "0:3:0:176,32,2\n"
+                                "0:3:0:192,40,0\n"
+                                "0:3:0:176,11,90\n");
+  REQUIRE(sequence.getEvent(1).position == 96*9);
+  REQUIRE(sequence.getEvent(3).position == 96*20);
+  REQUIRE_FALSE(sequence.notUndefined(2));
+
+  // snapshots follow edits
+  midi_port.clear();
+  sequence.addEvent(2, Event{96*4, Event::ProgChange, 0, 10, 0});
+  player.seek(1);
+  REQUIRE(midi_port.getLog() == "0:0:0:192,5,0\n"
+                                "0:0:0:176,7,100\n"
+                                "0:3:0:176,0,1\n"
+                                "0:3:0:176,32,2\n");
+  midi_port.clear();
+  player.seek(40);
+  REQUIRE(midi_port.getLog() == "0:0:0:192,5,0\n"
+                                "0:0:0:176,7,80\n"
+                                "0:0:0:176,10,20\n"
+                                "0:0:0:176,64,127\n"
+                                "0:0:0:224,0,80\n"
+                                "0:1:0:192,10,0\n"
+                                "0:3:0:176,0,1\n"
+                                "0:3:0:176,32,2\n"
+                                "0:3:0:192,40,0\n"
+                                "0:3:0:176,11,90\n");
+}
+
+int32_t recordedAt(Sequence &sequence, const uint8_t note)
+{
+  int32_t position {-1};
+  sequence.getBuffer().forEach(1, [&](const Event &event)
+  {
+    if ( event.param1 == note )
+      position = event.position;
+  });
+  return position;
+}
+
+TEST_CASE("Recorder timestamps", "[recorder]")
+{
+  TestMIDIPort midi_port;
+  TestTiming timing;
+  Sequence sequence;
+  Track &track {sequence.getTrack(1)};
+  track.length = 4;
+  track.state = Track::OVERDUBBING;
+  Recorder recorder{sequence, midi_port, midi_port};
+  recorder.setRecordTrack(1);
+  recorder.setIsRecording(true);
+  recorder.setMetronome(false);
+  Player player{sequence, midi_port, recorder};
+  player.setTempo(600000);
+  player.play();
+  auto play = [&](const int ticks)
+  {
+    for ( int i{0}; i < ticks; i ++ )
+    {
+      player.setTickTime(timing.getMicroseconds());
+      player.tick();
+      timing.delay(player.getDelay());
+    }
+  };
+
+  // tick 24 is due at 600000us, 25000us a tick
+  play(24);
+  recorder.receiveEvent(Event{0, Event::NoteOff, 0, 61, 0}, 590000);
+  recorder.receiveEvent(Event{0, Event::NoteOff, 0, 62, 0}, 580000);
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 63, 100}, 470000);
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 64, 100});
+  play(1);
+  REQUIRE(recordedAt(sequence, 61) == 24);
+  REQUIRE(recordedAt(sequence, 62) == 23);
+  REQUIRE(recordedAt(sequence, 63) == 18);
+  REQUIRE(recordedAt(sequence, 64) == 24);
+
+  // input latency is taken off before quantizing
+  recorder.setInputLatency(10000);
+  recorder.receiveEvent(Event{0, Event::NoteOff, 0, 65, 0}, 625000);
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 66, 100}, 535000);
+  play(1);
+  REQUIRE(recordedAt(sequence, 65) == 25);
+  REQUIRE(recordedAt(sequence, 66) == 18);
+
+  // just before the loop starts over lands at its end
+  play(96 - 26);
+  REQUIRE(timing.getMicroseconds() == 2400000);
+  recorder.receiveEvent(Event{0, Event::NoteOff, 0, 67, 0}, 2390000);
+  recorder.receiveEvent(Event{0, Event::NoteOff, 0, 68, 0}, 2385000);
+  recorder.receiveEvent(Event{0, Event::NoteOn, 0, 69, 100}, 2345000);
+  play(1);
+  REQUIRE(recordedAt(sequence, 67) == 95);
+  REQUIRE(recordedAt(sequence, 68) == 95);
+  REQUIRE(recordedAt(sequence, 69) == 0);
+}
+
 /*TEST_CASE("Recorder delete", "[recorder]")
 {
   TestMIDIPort midi_port;